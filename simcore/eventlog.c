@@ -0,0 +1,263 @@
+/*
+ * eventlog.c
+ * delta-encoded binary log of agent states and its reader
+ * maarten
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "eventlog.h"
+
+#define MAGIC "SOCEVLOG"
+
+/* prototypes */
+static void putvarint(EventLog *, unsigned int);
+static void flushbuf(EventLog *);
+static int getvarint(FILE *, unsigned int *);
+static unsigned int zigzag(int);
+static int unzigzag(unsigned int);
+
+/* eventlog_open: write the header, the grid follows with eventlog_agent() */
+EventLog * eventlog_open(char * filename, int model, int size, int maxage, int agemin,
+			 int nfields, char * fieldtypes)
+{
+  assert(nfields <= EVENTLOG_MAXFIELDS);
+  EventLog * log = (EventLog *) malloc(sizeof(EventLog));
+  assert(log);
+  log -> fp = fopen(filename, "wb");
+  assert(log -> fp);
+  log -> nagents = size * size;
+  log -> nwritten = 0;
+  log -> nfields = nfields;
+  memcpy(log -> fieldtypes, fieldtypes, nfields);
+  log -> nevents = 0;
+  log -> lastidx = -1;
+  log -> buflen = 0;
+  log -> bufsize = 4096;
+  log -> buf = (unsigned char *) malloc(log -> bufsize);
+  assert(log -> buf);
+
+  fwrite(MAGIC, 1, strlen(MAGIC), log -> fp);
+  putvarint(log, EVENTLOG_VERSION);
+  putvarint(log, model);
+  putvarint(log, size);
+  putvarint(log, maxage);
+  putvarint(log, agemin);
+  putvarint(log, nfields);
+  int f;
+  for (f = 0; f < nfields; ++f)
+    putvarint(log, fieldtypes[f]);
+  flushbuf(log);
+  return log;
+}
+
+/* eventlog_agent: next agent of the initial grid, in index order */
+void eventlog_agent(EventLog * log, int age, unsigned int * fields)
+{
+  putvarint(log, age);
+  int f;
+  for (f = 0; f < log -> nfields; ++f)
+    putvarint(log, (log -> fieldtypes[f] == 'i') ? zigzag((int) fields[f]) : fields[f]);
+  if (++log -> nwritten == log -> nagents || log -> buflen > log -> bufsize / 2)
+    flushbuf(log);
+}
+
+/* eventlog_change: agent idx went from oldfields to newfields in this step,
+   called in increasing idx order */
+void eventlog_change(EventLog * log, int idx, unsigned int * oldfields, unsigned int * newfields)
+{
+  unsigned int mask = 0;
+  int f;
+  for (f = 0; f < log -> nfields; ++f)
+    if (oldfields[f] != newfields[f])
+      mask |= 1 << f;
+  if (!mask)
+    return;
+  putvarint(log, idx - log -> lastidx - 1);
+  putvarint(log, mask);
+  for (f = 0; f < log -> nfields; ++f)
+    if (mask & (1 << f))
+      putvarint(log, oldfields[f] ^ newfields[f]);
+  log -> lastidx = idx;
+  log -> nevents++;
+}
+
+/* eventlog_endstep: write the events of the step */
+void eventlog_endstep(EventLog * log)
+{
+  unsigned char count[5];
+  int n = 0;
+  unsigned int v = log -> nevents;
+  do {
+    count[n++] = (v & 0x7f) | ((v > 0x7f) ? 0x80 : 0);
+    v >>= 7;
+  } while (v);
+  fwrite(count, 1, n, log -> fp);
+  flushbuf(log);
+  log -> nevents = 0;
+  log -> lastidx = -1;
+}
+
+void eventlog_close(EventLog * log)
+{
+  flushbuf(log);
+  fclose(log -> fp);
+  free(log -> buf);
+  free(log);
+}
+
+/* eventreader_open: read header and initial grid */
+EventReader * eventreader_open(char * filename)
+{
+  FILE * fp = fopen(filename, "rb");
+  if (!fp)
+    return NULL;
+  char magic[8];
+  unsigned int version, v;
+  if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, MAGIC, 8)
+      || !getvarint(fp, &version) || version != EVENTLOG_VERSION) {
+    fclose(fp);
+    return NULL;
+  }
+  EventReader * rd = (EventReader *) malloc(sizeof(EventReader));
+  assert(rd);
+  rd -> fp = fp;
+  rd -> step = 0;
+  rd -> nevents = 0;
+  unsigned int hdr[5];
+  int h;
+  for (h = 0; h < 5; ++h)
+    if (!getvarint(fp, &hdr[h]))
+      goto fail;
+  rd -> model = hdr[0];
+  rd -> size = hdr[1];
+  rd -> maxage = hdr[2];
+  rd -> agemin = hdr[3];
+  rd -> nfields = hdr[4];
+  if (rd -> nfields > EVENTLOG_MAXFIELDS)
+    goto fail;
+  int f;
+  for (f = 0; f < rd -> nfields; ++f) {
+    if (!getvarint(fp, &v))
+      goto fail;
+    rd -> fieldtypes[f] = v;
+  }
+
+  int n = rd -> size * rd -> size;
+  rd -> ages = (int *) malloc(n * sizeof(int));
+  rd -> fields = (unsigned int *) malloc(n * rd -> nfields * sizeof(unsigned int));
+  assert(rd -> ages && rd -> fields);
+  int i;
+  for (i = 0; i < n; ++i) {
+    if (!getvarint(fp, &v))
+      goto failgrid;
+    rd -> ages[i] = v;
+    for (f = 0; f < rd -> nfields; ++f) {
+      if (!getvarint(fp, &v))
+	goto failgrid;
+      rd -> fields[i * rd -> nfields + f] = (rd -> fieldtypes[f] == 'i') ? unzigzag(v) : v;
+    }
+  }
+  return rd;
+
+ failgrid:
+  free(rd -> ages);
+  free(rd -> fields);
+ fail:
+  fclose(fp);
+  free(rd);
+  return NULL;
+}
+
+/* eventreader_next: advance to the next step, 0 at the end of the log */
+int eventreader_next(EventReader * rd)
+{
+  unsigned int nevents, gap, mask, delta;
+  if (!getvarint(rd -> fp, &nevents))
+    return 0;
+  int n = rd -> size * rd -> size;
+  int i;
+  for (i = 0; i < n; ++i)
+    if (++rd -> ages[i] > rd -> maxage)
+      rd -> ages[i] = rd -> agemin;
+  int idx = -1;
+  unsigned int e;
+  for (e = 0; e < nevents; ++e) {
+    if (!getvarint(rd -> fp, &gap) || !getvarint(rd -> fp, &mask))
+      return 0;
+    idx += gap + 1;
+    if (idx >= n)
+      return 0;
+    int f;
+    for (f = 0; f < rd -> nfields; ++f) {
+      if (mask & (1 << f)) {
+	if (!getvarint(rd -> fp, &delta))
+	  return 0;
+	rd -> fields[idx * rd -> nfields + f] ^= delta;
+      }
+    }
+  }
+  rd -> nevents = nevents;
+  rd -> step++;
+  return 1;
+}
+
+void eventreader_close(EventReader * rd)
+{
+  fclose(rd -> fp);
+  free(rd -> ages);
+  free(rd -> fields);
+  free(rd);
+}
+
+/* helpers */
+static void putvarint(EventLog * log, unsigned int v)
+{
+  if (log -> buflen + 5 > log -> bufsize) {
+    log -> bufsize *= 2;
+    log -> buf = (unsigned char *) realloc(log -> buf, log -> bufsize);
+    assert(log -> buf);
+  }
+  while (v > 0x7f) {
+    log -> buf[log -> buflen++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  log -> buf[log -> buflen++] = v;
+}
+
+static void flushbuf(EventLog * log)
+{
+  fwrite(log -> buf, 1, log -> buflen, log -> fp);
+  log -> buflen = 0;
+}
+
+static int getvarint(FILE * fp, unsigned int * v)
+{
+  unsigned int result = 0;
+  int shift = 0;
+  int c;
+  while ((c = getc(fp)) != EOF) {
+    result |= (unsigned int) (c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      *v = result;
+      return 1;
+    }
+    shift += 7;
+    if (shift > 28)
+      return 0;
+  }
+  return 0;
+}
+
+static unsigned int zigzag(int v)
+{
+  return ((unsigned int) v << 1) ^ (unsigned int) (v >> 31);
+}
+
+static int unzigzag(unsigned int v)
+{
+  return (int) (v >> 1) ^ -(int) (v & 1);
+}
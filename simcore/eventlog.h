@@ -0,0 +1,71 @@
+/*
+ * eventlog.h
+ * delta-encoded binary log of agent states and its reader
+ * maarten
+ *
+ * An agent state is an age plus nfields 32-bit fields ('i': int, 'f':
+ * float bits). The log holds the initial grid once and then, per step,
+ * only the agents whose fields changed. Ages are not logged after the
+ * initial grid: every step they advance by one and wrap from beyond
+ * maxage to agemin, which the reader replays.
+ *
+ * layout, all integers LEB128 varints:
+ *   "SOCEVLOG" version model size maxage agemin nfields fieldtypes[nfields]
+ *   initial grid: per agent age, fields (zigzag for ints, raw bits for floats)
+ *   per step: nevents, per event index gap, field mask, field xor deltas
+ */
+
+#ifndef EVENTLOG_H_
+#define EVENTLOG_H_
+
+#define EVENTLOG_VERSION 1
+#define EVENTLOG_MAXFIELDS 8
+
+#define MODEL_SOCIMPACT 0 /* fields: item, status */
+#define MODEL_SOCINTER 1  /* fields: status, item; utility is not logged */
+
+typedef struct {
+  FILE * fp;
+  int nagents;
+  int nwritten; /* agents of the initial grid */
+  int nfields;
+  char fieldtypes[EVENTLOG_MAXFIELDS];
+  int nevents;
+  int lastidx;
+  unsigned char * buf; /* events of the current step */
+  size_t buflen;
+  size_t bufsize;
+} EventLog;
+
+typedef struct {
+  FILE * fp;
+  int model;
+  int size;
+  int maxage;
+  int agemin;
+  int nfields;
+  char fieldtypes[EVENTLOG_MAXFIELDS];
+  int step;
+  int nevents;   /* changes applied by the last eventreader_next() */
+  int * ages;
+  unsigned int * fields; /* nfields per agent */
+} EventReader;
+
+EventLog * eventlog_open(char * filename,
+			 int model,
+			 int size,
+			 int maxage,
+			 int agemin,
+			 int nfields,
+			 char * fieldtypes
+			 );
+void eventlog_agent(EventLog *, int, unsigned int *);
+void eventlog_change(EventLog *, int, unsigned int *, unsigned int *);
+void eventlog_endstep(EventLog *);
+void eventlog_close(EventLog *);
+
+EventReader * eventreader_open(char * filename);
+int eventreader_next(EventReader *);
+void eventreader_close(EventReader *);
+
+#endif /* EVENTLOG_H_ */
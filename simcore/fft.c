@@ -0,0 +1,200 @@
+/*
+ * fft.c
+ * complex FFT of any length and toroidal convolution on size x size grids
+ * powers of two use an iterative radix-2 transform, other lengths go
+ * through Bluestein's chirp-z transform on a power of two
+ * maarten
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <complex.h>
+
+#include "fft.h"
+
+/* prototypes */
+static void radix2(double complex *, int, double complex *, int);
+
+/* fft_plan: plan transforms of length n */
+FFTPlan * fft_plan(int n)
+{
+  FFTPlan * plan = (FFTPlan *) malloc(sizeof(FFTPlan));
+  assert(plan);
+  plan -> n = n;
+  plan -> m = 1;
+  while (plan -> m < n)
+    plan -> m <<= 1;
+  if (plan -> m != n) {
+    plan -> m = 1;
+    while (plan -> m < 2 * n - 1)
+      plan -> m <<= 1;
+  }
+  int m = plan -> m;
+  plan -> twiddles = (double complex *) malloc((m / 2 + 1) * sizeof(double complex));
+  assert(plan -> twiddles);
+  int k;
+  for (k = 0; k < m / 2; ++k)
+    plan -> twiddles[k] = cexp(-2.0 * M_PI * I * k / m);
+
+  plan -> chirp = NULL;
+  plan -> chirphat = NULL;
+  if (m != n) {
+    plan -> chirp = (double complex *) malloc(n * sizeof(double complex));
+    plan -> chirphat = (double complex *) calloc(m, sizeof(double complex));
+    assert(plan -> chirp && plan -> chirphat);
+    for (k = 0; k < n; ++k) {
+      long k2 = ((long) k * k) % (2 * n); // keeps the angle exact
+      plan -> chirp[k] = cexp(-M_PI * I * k2 / n);
+    }
+    plan -> chirphat[0] = 1.0;
+    for (k = 1; k < n; ++k)
+      plan -> chirphat[k] = plan -> chirphat[m - k] = conj(plan -> chirp[k]);
+    radix2(plan -> chirphat, m, plan -> twiddles, 0);
+  }
+  return plan;
+}
+
+/* fft: in-place transform of data, unnormalized; work holds plan -> m
+   values and is only used for Bluestein lengths */
+void fft(FFTPlan * plan, double complex * data, double complex * work, int inverse)
+{
+  int n = plan -> n;
+  int m = plan -> m;
+  if (m == n) {
+    radix2(data, n, plan -> twiddles, inverse);
+    return;
+  }
+  // the inverse is the conjugate of the forward transform of the conjugate
+  int k;
+  for (k = 0; k < n; ++k)
+    work[k] = (inverse ? conj(data[k]) : data[k]) * plan -> chirp[k];
+  for (k = n; k < m; ++k)
+    work[k] = 0.0;
+  radix2(work, m, plan -> twiddles, 0);
+  for (k = 0; k < m; ++k)
+    work[k] *= plan -> chirphat[k];
+  radix2(work, m, plan -> twiddles, 1);
+  for (k = 0; k < n; ++k) {
+    double complex x = work[k] * plan -> chirp[k] / m;
+    data[k] = inverse ? conj(x) : x;
+  }
+}
+
+/* fft2: in-place 2d transform of an n x n row-major grid, the inverse is
+   normalized; rows and then columns are shared out over the threads */
+void fft2(FFTPlan * plan, double complex * grid, int inverse)
+{
+  int n = plan -> n;
+#pragma omp parallel
+  {
+    double complex * work = (double complex *) malloc((plan -> m + n) * sizeof(double complex));
+    double complex * column = work + plan -> m;
+    assert(work);
+    int r, c;
+#pragma omp for schedule(static)
+    for (r = 0; r < n; ++r)
+      fft(plan, grid + r * n, work, inverse);
+#pragma omp for schedule(static)
+    for (c = 0; c < n; ++c) {
+      for (r = 0; r < n; ++r)
+	column[r] = grid[r * n + c];
+      fft(plan, column, work, inverse);
+      for (r = 0; r < n; ++r)
+	grid[r * n + c] = inverse ? column[r] / ((double) n * n) : column[r];
+    }
+    free(work);
+  }
+}
+
+void fft_free(FFTPlan * plan)
+{
+  free(plan -> twiddles);
+  free(plan -> chirp);
+  free(plan -> chirphat);
+  free(plan);
+}
+
+/* torusconv_new: kernel[dx * size + dy] is the weight at displacement (dx, dy) */
+TorusConv * torusconv_new(int size, double * kernel)
+{
+  TorusConv * conv = (TorusConv *) malloc(sizeof(TorusConv));
+  assert(conv);
+  int n = size * size;
+  conv -> size = size;
+  conv -> plan = fft_plan(size);
+  conv -> kernelhat = (double *) malloc(n * sizeof(double));
+  conv -> work = (double complex *) malloc(n * sizeof(double complex));
+  assert(conv -> kernelhat && conv -> work);
+  int i;
+  for (i = 0; i < n; ++i)
+    conv -> work[i] = kernel[i];
+  fft2(conv -> plan, conv -> work, 0);
+  for (i = 0; i < n; ++i)
+    conv -> kernelhat[i] = creal(conv -> work[i]);
+  return conv;
+}
+
+/* torusconv_apply2: out = kernel * in for two real fields at the cost of
+   one complex transform pair; in2 and out2 may be NULL */
+void torusconv_apply2(TorusConv * conv, double * in1, double * in2, double * out1, double * out2)
+{
+  int n = conv -> size * conv -> size;
+  double complex * work = conv -> work;
+  int i;
+#pragma omp parallel for schedule(static)
+  for (i = 0; i < n; ++i)
+    work[i] = in1[i] + (in2 ? in2[i] * I : 0.0);
+  fft2(conv -> plan, work, 0);
+#pragma omp parallel for schedule(static)
+  for (i = 0; i < n; ++i)
+    work[i] *= conv -> kernelhat[i];
+  fft2(conv -> plan, work, 1);
+#pragma omp parallel for schedule(static)
+  for (i = 0; i < n; ++i) {
+    out1[i] = creal(work[i]);
+    if (out2)
+      out2[i] = cimag(work[i]);
+  }
+}
+
+void torusconv_free(TorusConv * conv)
+{
+  fft_free(conv -> plan);
+  free(conv -> kernelhat);
+  free(conv -> work);
+  free(conv);
+}
+
+/* radix2: iterative in-place transform of length n, a power of two */
+static void radix2(double complex * a, int n, double complex * twiddles, int inverse)
+{
+  int i, j, len;
+  for (i = 1, j = 0; i < n; ++i) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      double complex t = a[i];
+      a[i] = a[j];
+      a[j] = t;
+    }
+  }
+  for (len = 2; len <= n; len <<= 1) {
+    int stride = n / len;
+    for (i = 0; i < n; i += len) {
+      for (j = 0; j < len / 2; ++j) {
+	double complex w = twiddles[j * stride];
+	if (inverse)
+	  w = conj(w);
+	double complex u = a[i + j];
+	double complex v = a[i + j + len / 2] * w;
+	a[i + j] = u + v;
+	a[i + j + len / 2] = u - v;
+      }
+    }
+  }
+}
@@ -0,0 +1,37 @@
+/*
+ * fft.h
+ * complex FFT of any length and toroidal convolution on size x size grids
+ * maarten
+ */
+
+#ifndef FFT_H_
+#define FFT_H_
+
+#include <complex.h>
+
+typedef struct {
+  int n;
+  int m;                      /* transform length, n or the Bluestein length */
+  double complex * twiddles;  /* m / 2 */
+  double complex * chirp;     /* n, Bluestein only */
+  double complex * chirphat;  /* m, Bluestein only */
+} FFTPlan;
+
+/* convolution with a fixed kernel of point symmetry, K(d) == K(-d) */
+typedef struct {
+  int size;
+  FFTPlan * plan;
+  double * kernelhat;         /* real spectrum of the kernel */
+  double complex * work;      /* size * size */
+} TorusConv;
+
+FFTPlan * fft_plan(int);
+void fft(FFTPlan *, double complex *, double complex *, int);
+void fft2(FFTPlan *, double complex *, int);
+void fft_free(FFTPlan *);
+
+TorusConv * torusconv_new(int, double *);
+void torusconv_apply2(TorusConv *, double *, double *, double *, double *);
+void torusconv_free(TorusConv *);
+
+#endif /* FFT_H_ */
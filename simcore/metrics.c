@@ -0,0 +1,127 @@
+/*
+ * metrics.c
+ * live per-step metrics in shared memory, see metrics.h
+ * maarten
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "metrics.h"
+
+#define METRICS_SMOOTH 0.2 /* weight of the last step in stepspersec */
+
+/* runs opened by this process, several may be live at once */
+static int nopened = 0;
+
+/* prototypes */
+static double now(clockid_t);
+
+/* metrics_open: a segment of the run's own; a run without one just goes
+   on unmonitored */
+Metrics * metrics_open(int model, int nsteps, const char * label)
+{
+  Metrics * m = (Metrics *) calloc(1, sizeof(Metrics));
+  if (!m)
+    return NULL;
+  m -> owner = getpid();
+  sprintf(m -> name, "%s%d.%d", METRICS_PREFIX, (int) m -> owner,
+	  __atomic_fetch_add(&nopened, 1, __ATOMIC_RELAXED));
+  int fd = shm_open(m -> name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, sizeof(MetricsBlock))) {
+    perror(m -> name);
+    if (fd >= 0) {
+      close(fd);
+      shm_unlink(m -> name);
+    }
+    free(m);
+    return NULL;
+  }
+  m -> block = (MetricsBlock *) mmap(NULL, sizeof(MetricsBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m -> block == MAP_FAILED) {
+    perror(m -> name);
+    shm_unlink(m -> name);
+    free(m);
+    return NULL;
+  }
+  MetricsBlock * b = m -> block;
+  b -> model = model;
+  b -> pid = m -> owner;
+  b -> nsteps = nsteps;
+  snprintf(b -> label, METRICS_LABEL, "%s", label);
+  m -> started = m -> last = now(CLOCK_MONOTONIC);
+  b -> updated = now(CLOCK_REALTIME);
+  __atomic_store_n(&b -> magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+  return m;
+}
+
+/* metrics_publish: the state after a step; stepseconds is the running
+   kernel time, the step's own kernel time is its increase */
+void metrics_publish(Metrics * m, int currentstep, int mostfrequent, float homogeneity, double stepseconds)
+{
+  if (!m)
+    return;
+  MetricsBlock * b = m -> block;
+  double t = now(CLOCK_MONOTONIC);
+  double dt = t - m -> last;
+  double kernel = stepseconds - m -> lastkernels;
+  uint32_t seq = b -> seq;
+  __atomic_store_n(&b -> seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  b -> currentstep = currentstep;
+  b -> mostfrequent = mostfrequent;
+  b -> homogeneity = homogeneity;
+  if (dt > 0.0)
+    b -> stepspersec = (b -> stepspersec > 0.0)
+      ? (1.0 - METRICS_SMOOTH) * b -> stepspersec + METRICS_SMOOTH / dt
+      : 1.0 / dt;
+  b -> stepseconds = stepseconds;
+  b -> lastkernel = kernel;
+  b -> lastreport = dt - kernel;
+  b -> elapsed = t - m -> started;
+  b -> updated = now(CLOCK_REALTIME);
+  __atomic_store_n(&b -> seq, seq + 2, __ATOMIC_RELEASE);
+  m -> last = t;
+  m -> lastkernels = stepseconds;
+}
+
+/* metrics_close: unmap, and remove the segment if this process made it;
+   a forked copy leaves its parent's segment alone */
+void metrics_close(Metrics * m)
+{
+  if (!m)
+    return;
+  munmap(m -> block, sizeof(MetricsBlock));
+  if (m -> owner == getpid())
+    shm_unlink(m -> name);
+  free(m);
+}
+
+/* metrics_read: a consistent copy of a block another process writes, 0
+   if it is not a metrics block or kept changing */
+int metrics_read(const MetricsBlock * b, MetricsBlock * out)
+{
+  int tries;
+  for (tries = 0; tries < 1000; ++tries) {
+    uint32_t s1 = __atomic_load_n(&b -> seq, __ATOMIC_ACQUIRE);
+    if (s1 & 1)
+      continue;
+    memcpy(out, b, sizeof(MetricsBlock));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&b -> seq, __ATOMIC_RELAXED) == s1)
+      return out -> magic == METRICS_MAGIC;
+  }
+  return 0;
+}
+
+static double now(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
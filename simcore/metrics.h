@@ -0,0 +1,60 @@
+/*
+ * metrics.h
+ * live per-step metrics of a run in POSIX shared memory, for simcore's
+ * socmon to read while the run goes on
+ * maarten
+ *
+ * A run publishes one MetricsBlock under /socsim.<pid>.<n>, n counting
+ * the runs of the process, so runs sharing a process each have their
+ * own. The writer makes seq odd, updates the fields and makes seq even
+ * again; a reader copies the block and keeps the copy only if seq was
+ * even and the same before and after, so neither side ever waits on the
+ * other.
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdint.h>
+
+#ifndef LIVEMETRICS
+#define LIVEMETRICS 0 /* publish per-step metrics in shared memory */
+#endif
+
+#define METRICS_PREFIX "/socsim."
+#define METRICS_MAGIC 0x3143544d /* "MTC1" */
+#define METRICS_LABEL 320
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;        /* odd while a write is under way */
+  int32_t model;       /* MODEL_SOCIMPACT or MODEL_SOCINTER */
+  int32_t pid;
+  int32_t nsteps;
+  int32_t currentstep;
+  int32_t mostfrequent;
+  float homogeneity;
+  double stepspersec;  /* smoothed over the last steps */
+  double stepseconds;  /* in the step kernels, in total */
+  double lastkernel;   /* the last step: its kernel */
+  double lastreport;   /* and the rest, reporting mostly */
+  double elapsed;      /* since metrics_open() */
+  double updated;      /* wall clock time of the last update */
+  char label[METRICS_LABEL]; /* the short report of the run */
+} MetricsBlock;
+
+typedef struct {
+  MetricsBlock * block;
+  char name[32];
+  int32_t owner;       /* pid that unlinks the segment */
+  double started;
+  double last;         /* monotonic time of the last update */
+  double lastkernels;  /* stepseconds then */
+} Metrics;
+
+Metrics * metrics_open(int, int, const char *);
+void metrics_publish(Metrics *, int, int, float, double);
+void metrics_close(Metrics *);
+int metrics_read(const MetricsBlock *, MetricsBlock *);
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,328 @@
+/*
+ * numa.c
+ * grid buffers with first-touch placement, huge pages, thread pinning
+ * and per-node placement reports
+ *
+ * Buffers are touched page by page under a static OpenMP schedule, so
+ * with pinned threads the pages are spread over the threads' nodes in
+ * contiguous stretches. Kernels that sweep a buffer in that order find
+ * their part local; socimpact's impact kernels read the whole grid from
+ * every thread and see it spread, not local.
+ *
+ * The report gives this process's resident memory per node from
+ * /proc/self/numa_maps and the placement of the grid buffers; the
+ * allocation counters of /sys/devices/system/node count pages allocated
+ * by every process on the machine, and the traffic figure is modelled
+ * from the agent state the kernels read, not measured.
+ * maarten
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "numa.h"
+
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+#define NODE_PATH "/sys/devices/system/node/node%d/%s"
+#define PAGE_SAMPLES 4096 /* pages queried per buffer for placement */
+#define NUMA_POOL 32 /* freed buffers numa_keep() holds on to */
+
+/* buffers numa_free() kept, see numa_keep() */
+static struct {
+  void * p;
+  size_t len;
+} pool[NUMA_POOL];
+static int npool = 0;
+static int keep = 0;
+
+/* prototypes */
+static size_t maplength(size_t);
+static int readcpulist(int, int *, int);
+static void readnumamaps(long *);
+static void * pooled(size_t);
+
+/* numa_alloc: zeroed, page-aligned buffer, first touched by the threads */
+void * numa_alloc(size_t bytes)
+{
+  size_t len = maplength(bytes);
+  long pagesize = sysconf(_SC_PAGESIZE);
+  long npages = len / pagesize;
+  long pg;
+  void * p = pooled(len);
+  if (p) {
+    // mapped and placed already, zeroed under the same schedule
+#pragma omp parallel for schedule(static)
+    for (pg = 0; pg < npages; ++pg)
+      memset((char *) p + pg * pagesize, 0, pagesize);
+    return p;
+  }
+  p = MAP_FAILED;
+  if (HUGEPAGES == 2)
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p == MAP_FAILED) // no explicit huge pages reserved: fall back
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(p != MAP_FAILED);
+  if (HUGEPAGES == 1)
+    madvise(p, len, MADV_HUGEPAGE);
+
+#pragma omp parallel for schedule(static)
+  for (pg = 0; pg < npages; ++pg)
+    ((volatile char *) p)[pg * pagesize] = 0;
+  return p;
+}
+
+void numa_free(void * p, size_t bytes)
+{
+  if (!p)
+    return;
+  size_t len = maplength(bytes);
+  int kept = 0;
+#pragma omp critical(numa_pool)
+  if (keep && npool < NUMA_POOL) {
+    pool[npool].p = p;
+    pool[npool].len = len;
+    npool++;
+    kept = 1;
+  }
+  if (!kept)
+    munmap(p, len);
+}
+
+/* numa_keep: 1: numa_free() keeps buffers for numa_alloc() calls of the
+   same length to take back, mapped, touched and placed, for a process
+   that runs grid after grid; 0: unmap the kept ones and stop keeping */
+void numa_keep(int on)
+{
+#pragma omp critical(numa_pool)
+  {
+    keep = on;
+    if (!on) {
+      while (npool > 0) {
+	npool--;
+	munmap(pool[npool].p, pool[npool].len);
+      }
+    }
+  }
+}
+
+/* numa_pin: bind OpenMP thread t to a cpu, 1: cpus in order, 2: cpus
+   taken round-robin from the nodes */
+void numa_pin(int policy)
+{
+  if (!policy)
+    return;
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed))
+    return;
+  int order[CPU_SETSIZE];
+  int ncpus = 0;
+  int cpu;
+  if (policy == 2 && numa_nodes() > 1) {
+    int nodecpus[NUMA_MAXNODES][CPU_SETSIZE / 8];
+    int counts[NUMA_MAXNODES];
+    int nnodes = numa_nodes();
+    int node, k, more = 1;
+    for (node = 0; node < nnodes; ++node)
+      counts[node] = readcpulist(node, nodecpus[node], CPU_SETSIZE / 8);
+    for (k = 0; more; ++k) {
+      more = 0;
+      for (node = 0; node < nnodes; ++node) {
+	if (k < counts[node]) {
+	  more = 1;
+	  if (CPU_ISSET(nodecpus[node][k], &allowed))
+	    order[ncpus++] = nodecpus[node][k];
+	}
+      }
+    }
+  } else {
+    for (cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      if (CPU_ISSET(cpu, &allowed))
+	order[ncpus++] = cpu;
+  }
+  if (!ncpus)
+    return;
+#pragma omp parallel
+  {
+    int t = 0;
+#ifdef _OPENMP
+    t = omp_get_thread_num();
+#endif
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(order[t % ncpus], &one);
+    sched_setaffinity(0, sizeof(cpu_set_t), &one);
+  }
+}
+
+/* numa_nodes: number of memory nodes, 1 without NUMA */
+int numa_nodes(void)
+{
+  int n = 0;
+  char path[100];
+  while (n < NUMA_MAXNODES) {
+    sprintf(path, NODE_PATH, n, "numastat");
+    if (access(path, R_OK))
+      break;
+    n++;
+  }
+  return n ? n : 1;
+}
+
+/* numa_snapshot: current per-node allocation counters */
+void numa_snapshot(NumaStat * stat)
+{
+  memset(stat, 0, sizeof(NumaStat));
+  stat -> nnodes = numa_nodes();
+  int node;
+  for (node = 0; node < stat -> nnodes; ++node) {
+    char path[100], key[50];
+    long value;
+    sprintf(path, NODE_PATH, node, "numastat");
+    FILE * fp = fopen(path, "r");
+    if (!fp)
+      continue;
+    while (fscanf(fp, "%49s %ld", key, &value) == 2) {
+      if (!strcmp(key, "numa_hit"))
+	stat -> hit[node] = value;
+      else if (!strcmp(key, "numa_miss"))
+	stat -> miss[node] = value;
+      else if (!strcmp(key, "local_node"))
+	stat -> local[node] = value;
+      else if (!strcmp(key, "other_node"))
+	stat -> other[node] = value;
+    }
+    fclose(fp);
+  }
+}
+
+/* numa_report: the node placement of the given buffers and of the
+   process, the system-wide allocation counter deltas since start and the
+   modelled agent state traffic of the step kernels */
+void numa_report(FILE * fp, NumaStat * start, void ** buffers, size_t * sizes, int nbuffers)
+{
+  NumaStat now;
+  numa_snapshot(&now);
+  long pagesize = sysconf(_SC_PAGESIZE);
+  long resident[NUMA_MAXNODES] = {0};
+  int b, node;
+  for (b = 0; b < nbuffers; ++b) {
+    long npages = maplength(sizes[b]) / pagesize;
+    long stride = (npages + PAGE_SAMPLES - 1) / PAGE_SAMPLES;
+    long nsamples = (npages + stride - 1) / stride;
+    void ** pages = (void **) malloc(nsamples * sizeof(void *));
+    int * status = (int *) malloc(nsamples * sizeof(int));
+    assert(pages && status);
+    long k;
+    for (k = 0; k < nsamples; ++k)
+      pages[k] = (char *) buffers[b] + k * stride * pagesize;
+    if (!syscall(SYS_move_pages, 0, nsamples, pages, NULL, status, 0))
+      for (k = 0; k < nsamples; ++k)
+	if (status[k] >= 0 && status[k] < NUMA_MAXNODES)
+	  resident[status[k]] += stride;
+    free(pages);
+    free(status);
+  }
+  long kbytes[NUMA_MAXNODES] = {0};
+  readnumamaps(kbytes);
+  fprintf(fp, "NUMA nodes:\t%d\n", now.nnodes);
+  for (node = 0; node < now.nnodes; ++node)
+    fprintf(fp, "NUMA node %d:\tgrid pages %ld\tprocess resident %ld kB"
+	    "\tsystem page allocations local %ld remote %ld misses %ld\n",
+	    node,
+	    resident[node],
+	    kbytes[node],
+	    now.local[node] - start -> local[node],
+	    now.other[node] - start -> other[node],
+	    now.miss[node] - start -> miss[node]);
+  fprintf(fp, "Step time:\t%.3f s\n", start -> seconds);
+  if (start -> seconds > 0.0)
+    fprintf(fp, "Modelled agent-state traffic:\t%.1f MB/s\n", start -> bytes / start -> seconds / 1e6);
+}
+
+/* helpers */
+static size_t maplength(size_t bytes)
+{
+  size_t unit = (HUGEPAGES == 2) ? HUGEPAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE);
+  if (!bytes)
+    bytes = 1;
+  return (bytes + unit - 1) / unit * unit;
+}
+
+/* pooled: a kept buffer of len bytes, NULL if there is none */
+static void * pooled(size_t len)
+{
+  void * p = NULL;
+  int k;
+#pragma omp critical(numa_pool)
+  for (k = npool - 1; k >= 0 && !p; --k)
+    if (pool[k].len == len) {
+      p = pool[k].p;
+      pool[k] = pool[--npool];
+    }
+  return p;
+}
+
+/* readcpulist: cpus of a node from its "0-3,8-11" style list */
+static int readcpulist(int node, int * cpus, int maxcpus)
+{
+  char path[100];
+  sprintf(path, NODE_PATH, node, "cpulist");
+  FILE * fp = fopen(path, "r");
+  if (!fp)
+    return 0;
+  int n = 0, lo, hi;
+  while (fscanf(fp, "%d", &lo) == 1) {
+    hi = lo;
+    int c = fgetc(fp);
+    if (c == '-') {
+      if (fscanf(fp, "%d", &hi) != 1)
+	break;
+      c = fgetc(fp);
+    }
+    for (; lo <= hi && n < maxcpus; ++lo)
+      cpus[n++] = lo;
+    if (c != ',')
+      break;
+  }
+  fclose(fp);
+  return n;
+}
+
+/* readnumamaps: resident kB of this process per node, from the N<node>=
+   page counts of every mapping in /proc/self/numa_maps */
+static void readnumamaps(long * kbytes)
+{
+  FILE * fp = fopen("/proc/self/numa_maps", "r");
+  if (!fp)
+    return;
+  char line[4096];
+  while (fgets(line, sizeof(line), fp)) {
+    long pages[NUMA_MAXNODES] = {0};
+    long pagekb = sysconf(_SC_PAGESIZE) / 1024;
+    char * save, * tok;
+    for (tok = strtok_r(line, " \n", &save); tok; tok = strtok_r(NULL, " \n", &save)) {
+      int node;
+      long value;
+      if (sscanf(tok, "N%d=%ld", &node, &value) == 2 && node >= 0 && node < NUMA_MAXNODES)
+	pages[node] += value;
+      else if (sscanf(tok, "kernelpagesize_kB=%ld", &value) == 1)
+	pagekb = value;
+    }
+    int node;
+    for (node = 0; node < NUMA_MAXNODES; ++node)
+      kbytes[node] += pages[node] * pagekb;
+  }
+  fclose(fp);
+}
@@ -0,0 +1,45 @@
+/*
+ * numa.h
+ * grid buffers with first-touch placement, huge pages, thread pinning
+ * and per-node placement reports
+ * maarten
+ */
+
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#include <stddef.h>
+
+#ifndef HUGEPAGES
+#define HUGEPAGES 0 /* 0: none 1: transparent 2: explicit, MAP_HUGETLB */
+#endif
+
+#ifndef PINTHREADS
+#define PINTHREADS 0 /* 0: none 1: compact 2: scatter over nodes */
+#endif
+
+#ifndef NUMAREPORT
+#define NUMAREPORT 0 /* per-node placement in the final report */
+#endif
+
+#define NUMA_MAXNODES 64
+
+typedef struct {
+  int nnodes;
+  long hit[NUMA_MAXNODES];
+  long miss[NUMA_MAXNODES];
+  long local[NUMA_MAXNODES];
+  long other[NUMA_MAXNODES];
+  double seconds;  /* step time */
+  double bytes;    /* agent state the step kernels read, modelled */
+} NumaStat;
+
+void * numa_alloc(size_t);
+void numa_free(void *, size_t);
+void numa_keep(int);
+void numa_pin(int);
+int numa_nodes(void);
+void numa_snapshot(NumaStat *);
+void numa_report(FILE *, NumaStat *, void **, size_t *, int);
+
+#endif /* NUMA_H_ */
@@ -0,0 +1,190 @@
+/*
+ * rng.c
+ * explicit state random numbers for the simulators
+ * maarten
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rng.h"
+
+#define RNG_MAGIC 0x31474e52 /* "RNG1" */
+#define RNG_GLIBC_SEP 3
+
+/* prototypes */
+static uint64_t splitmix64(uint64_t *);
+static void jumplanes(Rng *, const uint64_t *);
+static int32_t glibc_next(Rng *);
+
+/* rng_seed: RNG_GLIBC replays srand(seed), only the low 32 bits of seed
+   count; RNG_XOSHIRO seeds lane 0 through splitmix64 and puts every
+   further lane 2^128 draws ahead of the previous one */
+void rng_seed(Rng * rng, int mode, uint64_t seed)
+{
+  memset(rng, 0, sizeof(Rng));
+  rng -> mode = mode;
+  rng -> pos = RNG_BATCH;
+  rng -> key = rng_mix(seed); /* draws before the first rng_keyed() */
+  int i, l;
+  if (mode == RNG_GLIBC) {
+    // glibc srandom_r, TYPE_3
+    int32_t word = (int32_t) (uint32_t) seed;
+    if (word == 0)
+      word = 1;
+    rng -> r[0] = word;
+    for (i = 1; i < RNG_GLIBC_DEG; ++i) {
+      long hi = word / 127773;
+      long lo = word % 127773;
+      word = 16807 * lo - 2836 * hi;
+      if (word < 0)
+	word += 2147483647;
+      rng -> r[i] = word;
+    }
+    rng -> front = RNG_GLIBC_SEP;
+    rng -> rear = 0;
+    for (i = 0; i < 10 * RNG_GLIBC_DEG; ++i)
+      glibc_next(rng);
+    return;
+  }
+  uint64_t sm = seed;
+  for (i = 0; i < 4; ++i)
+    rng -> s[i][0] = splitmix64(&sm);
+  static const uint64_t jump[4] = {
+    0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+    0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+  };
+  for (l = 1; l < RNG_LANES; ++l) {
+    Rng tmp;
+    memset(&tmp, 0, sizeof(Rng));
+    for (i = 0; i < 4; ++i)
+      tmp.s[i][0] = rng -> s[i][l - 1];
+    jumplanes(&tmp, jump);
+    for (i = 0; i < 4; ++i)
+      rng -> s[i][l] = tmp.s[i][0];
+  }
+}
+
+/* rng_fill: n uniform floats in [0,1). xoshiro lanes are interleaved,
+   value k comes from lane k % RNG_LANES; the lane loop vectorizes */
+void rng_fill(Rng * rng, float * out, int n)
+{
+  int k = 0, l;
+  if (rng -> mode == RNG_GLIBC) {
+    for (k = 0; k < n; ++k)
+      out[k] = (float) glibc_next(rng) / ((float) RAND_MAX + 1);
+    return;
+  }
+  uint64_t (*s)[RNG_LANES] = rng -> s;
+  while (k < n) {
+    uint64_t res[RNG_LANES];
+    for (l = 0; l < RNG_LANES; ++l) {
+      uint64_t x = s[0][l] + s[3][l];
+      res[l] = ((x << 23) | (x >> 41)) + s[0][l];
+      uint64_t t = s[1][l] << 17;
+      s[2][l] ^= s[0][l];
+      s[3][l] ^= s[1][l];
+      s[1][l] ^= s[2][l];
+      s[0][l] ^= s[3][l];
+      s[2][l] ^= t;
+      s[3][l] = (s[3][l] << 45) | (s[3][l] >> 19);
+    }
+    for (l = 0; l < RNG_LANES && k < n; ++l, ++k)
+      out[k] = (res[l] >> 40) * (1.0f / 16777216.0f);
+  }
+}
+
+/* rng_jump: advance every lane by 2^192 draws (xoshiro long jump), which
+   gives a fresh set of non-overlapping streams; glibc mode reseeds from
+   its own next value */
+void rng_jump(Rng * rng)
+{
+  rng -> pos = RNG_BATCH;
+  if (rng -> mode == RNG_GLIBC) {
+    rng_seed(rng, RNG_GLIBC, glibc_next(rng));
+    return;
+  }
+  static const uint64_t longjump[4] = {
+    0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL,
+    0x77710069854ee241ULL, 0x39109bb02acbe635ULL
+  };
+  jumplanes(rng, longjump);
+}
+
+/* rng_split: child takes over the current streams, rng jumps past them,
+   for one generator per thread, agent group or branch */
+void rng_split(Rng * rng, Rng * child)
+{
+  *child = *rng;
+  child -> pos = RNG_BATCH;
+  rng_jump(rng);
+}
+
+/* rng_save: write the state, buffered floats included, so a loaded
+   generator continues with the very same numbers */
+int rng_save(Rng * rng, FILE * fp)
+{
+  uint32_t magic = RNG_MAGIC;
+  return fwrite(&magic, sizeof(magic), 1, fp) == 1
+    && fwrite(rng, sizeof(Rng), 1, fp) == 1;
+}
+
+int rng_load(Rng * rng, FILE * fp)
+{
+  uint32_t magic;
+  if (fread(&magic, sizeof(magic), 1, fp) != 1 || magic != RNG_MAGIC)
+    return 0;
+  if (fread(rng, sizeof(Rng), 1, fp) != 1)
+    return 0;
+  return (rng -> mode == RNG_GLIBC || rng -> mode == RNG_XOSHIRO)
+    && rng -> pos >= 0 && rng -> pos <= RNG_BATCH;
+}
+
+/* helpers */
+static uint64_t splitmix64(uint64_t * state)
+{
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/* jumplanes: apply a xoshiro256 jump polynomial to every lane */
+static void jumplanes(Rng * rng, const uint64_t * poly)
+{
+  uint64_t (*s)[RNG_LANES] = rng -> s;
+  uint64_t acc[4][RNG_LANES];
+  memset(acc, 0, sizeof(acc));
+  int i, b, l;
+  for (i = 0; i < 4; ++i)
+    for (b = 0; b < 64; ++b) {
+      if (poly[i] & (1ULL << b))
+	for (l = 0; l < RNG_LANES; ++l) {
+	  acc[0][l] ^= s[0][l];
+	  acc[1][l] ^= s[1][l];
+	  acc[2][l] ^= s[2][l];
+	  acc[3][l] ^= s[3][l];
+	}
+      for (l = 0; l < RNG_LANES; ++l) {
+	uint64_t t = s[1][l] << 17;
+	s[2][l] ^= s[0][l];
+	s[3][l] ^= s[1][l];
+	s[1][l] ^= s[2][l];
+	s[0][l] ^= s[3][l];
+	s[2][l] ^= t;
+	s[3][l] = (s[3][l] << 45) | (s[3][l] >> 19);
+      }
+    }
+  memcpy(s, acc, sizeof(acc));
+}
+
+/* glibc_next: glibc random_r, TYPE_3: r[i] = r[i-3] + r[i-31] */
+static int32_t glibc_next(Rng * rng)
+{
+  uint32_t val = (uint32_t) rng -> r[rng -> front] + (uint32_t) rng -> r[rng -> rear];
+  rng -> r[rng -> front] = (int32_t) val;
+  if (++rng -> front == RNG_GLIBC_DEG)
+    rng -> front = 0;
+  if (++rng -> rear == RNG_GLIBC_DEG)
+    rng -> rear = 0;
+  return (int32_t) (val >> 1);
+}
@@ -0,0 +1,86 @@
+/*
+ * rng.h
+ * explicit state random numbers: xoshiro256++ in interleaved lanes with
+ * jumps for stream splitting, or a replica of glibc's rand() sequence
+ * maarten
+ */
+
+#ifndef RNG_H_
+#define RNG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define RNG_GLIBC 0   /* same sequence as srand(seed); rand() */
+#define RNG_XOSHIRO 1
+
+#ifndef RNG_MODE
+#define RNG_MODE RNG_GLIBC /* generator of both simulators */
+#endif
+
+#ifndef RNG_CRN
+#define RNG_CRN 0 /* 1: common random numbers, draws keyed by decision, see rng_keyed() */
+#endif
+
+#define RNG_LANES 8     /* xoshiro streams advanced side by side */
+#define RNG_BATCH 256   /* floats generated per refill */
+#define RNG_GLIBC_DEG 31
+
+typedef struct {
+  int mode;
+  uint64_t s[4][RNG_LANES];           /* xoshiro state, lane l is s[.][l] */
+  int32_t r[RNG_GLIBC_DEG];           /* glibc additive feedback table */
+  int front;
+  int rear;
+  int pos;                            /* next unused float in buf */
+  float buf[RNG_BATCH];
+  uint64_t key;                       /* RNG_CRN: the keyed stream */
+} Rng;
+
+void rng_seed(Rng *, int, uint64_t);
+void rng_fill(Rng *, float *, int);
+void rng_jump(Rng *);
+void rng_split(Rng *, Rng *);
+int rng_save(Rng *, FILE *);
+int rng_load(Rng *, FILE *);
+
+/* rng_mix: splitmix64 finalizer */
+static inline uint64_t rng_mix(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/*
+ * rng_keyed: with RNG_CRN, start the stream of one random decision, keyed
+ * by seed, agent, step and purpose; the following rng_float() calls draw
+ * from it. Runs at other parameters then see the same numbers for the
+ * same decision however many draws the decisions before it took, which
+ * keeps their trajectories paired. A no-op otherwise.
+ */
+static inline void rng_keyed(Rng * rng, uint64_t seed, uint32_t agent, uint32_t step, uint32_t purpose)
+{
+  if (!RNG_CRN)
+    return;
+  uint64_t z = rng_mix(seed + 0x9e3779b97f4a7c15ULL);
+  z = rng_mix(z ^ ((uint64_t) agent << 32 | step));
+  rng -> key = rng_mix(z ^ purpose);
+}
+
+/* rng_float: uniform in [0,1), as (float) rand() / (RAND_MAX + 1.0);
+   with RNG_CRN the next number of the keyed stream */
+static inline float rng_float(Rng * rng)
+{
+  if (RNG_CRN) {
+    rng -> key += 0x9e3779b97f4a7c15ULL;
+    return (rng_mix(rng -> key) >> 40) * (1.0f / 16777216.0f);
+  }
+  if (rng -> pos == RNG_BATCH) {
+    rng_fill(rng, rng -> buf, RNG_BATCH);
+    rng -> pos = 0;
+  }
+  return rng -> buf[rng -> pos++];
+}
+
+#endif /* RNG_H_ */
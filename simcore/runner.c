@@ -0,0 +1,192 @@
+/*
+ * runner.c
+ * run simulator binaries in scratch directories and read their reports
+ * maarten
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include "runner.h"
+
+/* prototypes */
+static char * slurp(const char *);
+static void readreports(const char *, Run *);
+
+/* run_splitargs: split s in place on whitespace */
+int run_splitargs(char * s, char ** args, int maxargs)
+{
+  int n = 0;
+  char * tok = strtok(s, " \t");
+  while (tok && n < maxargs) {
+    args[n++] = tok;
+    tok = strtok(NULL, " \t");
+  }
+  return n;
+}
+
+/* run_start: launch binary + params with the given seed (the third model
+   argument) in a fresh scratch directory; extra binary arguments go after
+   the model arguments */
+void run_start(RunJob * job, char ** bin, int nbin, char ** params, int nparams, int seed, Run * run)
+{
+  const char * tmp = getenv("TMPDIR");
+  snprintf(job -> dir, RUN_NAME_SIZE - 2, "%s/socrun_XXXXXX", tmp ? tmp : "/tmp");
+  if (!mkdtemp(job -> dir)) {
+    perror("mkdtemp");
+    exit(EXIT_FAILURE);
+  }
+  char path[RUN_NAME_SIZE + 2];
+  char seedarg[32];
+  sprintf(path, "%s/", job -> dir);
+  sprintf(seedarg, "%d", seed);
+  char * argv[2 * RUN_MAXARGS + 2];
+  int n = 0, i;
+  argv[n++] = bin[0];
+  argv[n++] = path;
+  for (i = 0; i < nparams; ++i)
+    argv[n++] = (i == 2) ? seedarg : params[i];
+  for (i = 1; i < nbin; ++i)
+    argv[n++] = bin[i];
+  argv[n] = NULL;
+
+  memset(run, 0, sizeof(Run));
+  job -> run = run;
+  clock_gettime(CLOCK_MONOTONIC, &job -> start);
+  job -> pid = fork();
+  if (job -> pid < 0) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (job -> pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    execv(argv[0], argv);
+    perror(argv[0]);
+    _exit(127);
+  }
+}
+
+/* run_wait: wait for any of the njobs started jobs, read its reports and
+   mark it done (pid 0); returns the finished job */
+RunJob * run_wait(RunJob * jobs, int njobs)
+{
+  int status;
+  pid_t pid = wait(&status);
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  int i;
+  for (i = 0; i < njobs && jobs[i].pid != pid; ++i)
+    ;
+  if (pid < 0 || i == njobs) {
+    fprintf(stderr,"Lost track of a simulator run\n");
+    exit(EXIT_FAILURE);
+  }
+  RunJob * job = &jobs[i];
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr,"Simulator run failed, reports left in %s\n",job -> dir);
+    exit(EXIT_FAILURE);
+  }
+  job -> pid = 0;
+  job -> run -> seconds = (t1.tv_sec - job -> start.tv_sec) + (t1.tv_nsec - job -> start.tv_nsec) / 1e9;
+  readreports(job -> dir, job -> run);
+  return job;
+}
+
+/* run_model: one run, start to finish */
+void run_model(char ** bin, int nbin, char ** params, int nparams, int seed, Run * run)
+{
+  RunJob job;
+  run_start(&job, bin, nbin, params, nparams, seed, run);
+  run_wait(&job, 1);
+}
+
+/* run_free: release report buffers */
+void run_free(Run * run)
+{
+  free(run -> short_report);
+  free(run -> final_report);
+}
+
+/* slurp: whole file as a string */
+static char * slurp(const char * name)
+{
+  FILE * fp = fopen(name, "r");
+  if (!fp)
+    return NULL;
+  fseek(fp, 0, SEEK_END);
+  long len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  char * buf = (char *) malloc(len + 1);
+  if (fread(buf, 1, len, fp) != (size_t) len) {
+    fprintf(stderr,"Short read: %s\n",name);
+    exit(EXIT_FAILURE);
+  }
+  buf[len] = '\0';
+  fclose(fp);
+  return buf;
+}
+
+/* readreports: keep short and final report, compute the statistics and
+   remove the scratch directory */
+static void readreports(const char * dir, Run * run)
+{
+  char name[2 * RUN_NAME_SIZE];
+  DIR * d = opendir(dir);
+  struct dirent * e;
+  while ((e = readdir(d))) {
+    if (e -> d_name[0] == '.')
+      continue;
+    snprintf(name, sizeof(name), "%s/%s", dir, e -> d_name);
+    if (!strncmp(e -> d_name, "report_short", 12))
+      run -> short_report = slurp(name);
+    else if (!strncmp(e -> d_name, "report_final", 12))
+      run -> final_report = slurp(name);
+    unlink(name);
+  }
+  closedir(d);
+  rmdir(dir);
+  if (!run -> short_report || !run -> final_report) {
+    fprintf(stderr,"Missing reports in %s\n",dir);
+    exit(EXIT_FAILURE);
+  }
+
+  // short report: step followed by the tab separated columns
+  char * s = run -> short_report;
+  while (*s) {
+    int col = 0;
+    char * end;
+    for (;;) {
+      while (*s == ' ' || *s == '\t')
+	s++;
+      if (*s == '\n' || *s == '\0')
+	break;
+      double v = strtod(s, &end);
+      if (end == s)
+	break;
+      if (col < RUN_MAXCOLS)
+	run -> colmean[col] += v;
+      col++;
+      s = end;
+    }
+    if (run -> nsteps == 0)
+      run -> ncols = (col < RUN_MAXCOLS) ? col : RUN_MAXCOLS;
+    run -> nsteps++;
+    while (*s && *s != '\n')
+      s++;
+    if (*s)
+      s++;
+  }
+  int c;
+  for (c = 0; c < run -> ncols && run -> nsteps; ++c)
+    run -> colmean[c] /= run -> nsteps;
+
+  char * f = strstr(run -> final_report, "Number of changes:");
+  run -> nchanges = f ? atof(f + strlen("Number of changes:")) : 0.0;
+  f = strstr(run -> final_report, "Average homogeneity:");
+  run -> homogeneity = f ? atof(f + strlen("Average homogeneity:")) : 0.0;
+}
@@ -0,0 +1,42 @@
+/*
+ * runner.h
+ * run simulator binaries in scratch directories and read their reports,
+ * for the driver tools (socdiff, socsweep)
+ * maarten
+ */
+
+#ifndef RUNNER_H_
+#define RUNNER_H_
+
+#include <sys/types.h>
+#include <time.h>
+
+#define RUN_MAXARGS 64
+#define RUN_MAXCOLS 64
+#define RUN_NAME_SIZE 512
+
+typedef struct {
+  char * short_report;
+  char * final_report;
+  int nsteps; /* short report lines */
+  int ncols;
+  double colmean[RUN_MAXCOLS]; /* short report column means over steps */
+  double nchanges;
+  double homogeneity;
+  double seconds;
+} Run;
+
+typedef struct {
+  pid_t pid;
+  char dir[RUN_NAME_SIZE];
+  struct timespec start;
+  Run * run;
+} RunJob;
+
+int run_splitargs(char *, char **, int);
+void run_start(RunJob *, char **, int, char **, int, int, Run *);
+RunJob * run_wait(RunJob *, int);
+void run_model(char **, int, char **, int, int, Run *);
+void run_free(Run *);
+
+#endif /* RUNNER_H_ */
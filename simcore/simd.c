@@ -0,0 +1,206 @@
+/*
+ * simd.c
+ * masked per-label accumulation, see simd.h
+ * maarten
+ */
+
+#include <immintrin.h>
+
+#include "simd.h"
+
+/* prototypes */
+static void labelsums_scalar(const int *, const float *, const float *, int, int, int, float *);
+static void labelsums_avx2(const int *, const float *, const float *, int, int, float *);
+static void labelsums_avx512(const int *, const float *, const float *, int, int, float *);
+static void fixedsums_scalar(const int *, const unsigned int *, const unsigned int *, int,
+			     unsigned long long *);
+static void fixedsums_avx2(const int *, const unsigned int *, const unsigned int *, int, int,
+			   unsigned long long *);
+static void fixedsums_avx512(const int *, const unsigned int *, const unsigned int *, int, int,
+			     unsigned long long *);
+
+/* simd_level: best variant the cpu runs, capped at SIMD_MAXLEVEL */
+int simd_level(void)
+{
+  __builtin_cpu_init();
+  if (SIMD_MAXLEVEL >= SIMD_AVX512 && __builtin_cpu_supports("avx512f"))
+    return SIMD_AVX512;
+  if (SIMD_MAXLEVEL >= SIMD_AVX2 && __builtin_cpu_supports("avx2"))
+    return SIMD_AVX2;
+  return SIMD_SCALAR;
+}
+
+/* simd_labelsums: n sources into acc, nlabels <= SIMD_MAXLABELS */
+void simd_labelsums(int level, const int * labels, const float * num, const float * den,
+		    int n, int nlabels, float * acc)
+{
+  int body = n - n % SIMD_LANES;
+  if (level == SIMD_AVX512)
+    labelsums_avx512(labels, num, den, body, nlabels, acc);
+  else if (level == SIMD_AVX2)
+    labelsums_avx2(labels, num, den, body, nlabels, acc);
+  else
+    body = 0;
+  labelsums_scalar(labels, num, den, body, n, nlabels, acc);
+}
+
+/* simd_lanesum: sums[k] = the lanes of label k, added in lane order */
+void simd_lanesum(const float * acc, int nlabels, float * sums)
+{
+  int k, l;
+  for (k = 0; k < nlabels; ++k) {
+    sums[k] = 0.0;
+    for (l = 0; l < SIMD_LANES; ++l)
+      sums[k] += acc[k * SIMD_LANES + l];
+  }
+}
+
+/* simd_fixedsums: n sources into acc[0..nlabels-1] */
+void simd_fixedsums(int level, const int * labels, const unsigned int * num, const unsigned int * kern,
+		    int n, int nlabels, unsigned long long * acc)
+{
+  int body = n - n % SIMD_LANES;
+  if (nlabels > SIMD_MAXLABELS)
+    body = 0;
+  else if (level == SIMD_AVX512)
+    fixedsums_avx512(labels, num, kern, body, nlabels, acc);
+  else if (level == SIMD_AVX2)
+    fixedsums_avx2(labels, num, kern, body, nlabels, acc);
+  else
+    body = 0;
+  fixedsums_scalar(labels + body, num + body, kern + body, n - body, acc);
+}
+
+/* labelsums_scalar: sources from..n-1 */
+static void labelsums_scalar(const int * labels, const float * num, const float * den,
+			     int from, int n, int nlabels, float * acc)
+{
+  int j;
+  for (j = from; j < n; ++j)
+    if (labels[j] >= 0 && den[j] != 0.0)
+      acc[labels[j] * SIMD_LANES + j % SIMD_LANES] += num[j] / den[j];
+}
+
+/* labelsums_avx2: a label's 16 lanes in two registers; masked lanes add
+   +0.0, which leaves the non-negative sums as they are */
+__attribute__((target("avx2")))
+static void labelsums_avx2(const int * labels, const float * num, const float * den,
+			   int n, int nlabels, float * acc)
+{
+  __m256 lo[SIMD_MAXLABELS], hi[SIMD_MAXLABELS];
+  int k, j;
+  for (k = 0; k < nlabels; ++k) {
+    lo[k] = _mm256_loadu_ps(acc + k * SIMD_LANES);
+    hi[k] = _mm256_loadu_ps(acc + k * SIMD_LANES + 8);
+  }
+  const __m256 zero = _mm256_setzero_ps();
+  for (j = 0; j < n; j += SIMD_LANES) {
+    __m256i l0 = _mm256_loadu_si256((const __m256i *) (labels + j));
+    __m256i l1 = _mm256_loadu_si256((const __m256i *) (labels + j + 8));
+    __m256 d0 = _mm256_loadu_ps(den + j);
+    __m256 d1 = _mm256_loadu_ps(den + j + 8);
+    __m256 v0 = _mm256_and_ps(_mm256_div_ps(_mm256_loadu_ps(num + j), d0),
+			      _mm256_cmp_ps(d0, zero, _CMP_NEQ_OQ));
+    __m256 v1 = _mm256_and_ps(_mm256_div_ps(_mm256_loadu_ps(num + j + 8), d1),
+			      _mm256_cmp_ps(d1, zero, _CMP_NEQ_OQ));
+    for (k = 0; k < nlabels; ++k) {
+      __m256i key = _mm256_set1_epi32(k);
+      __m256 m0 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(l0, key));
+      __m256 m1 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(l1, key));
+      lo[k] = _mm256_add_ps(lo[k], _mm256_and_ps(v0, m0));
+      hi[k] = _mm256_add_ps(hi[k], _mm256_and_ps(v1, m1));
+    }
+  }
+  for (k = 0; k < nlabels; ++k) {
+    _mm256_storeu_ps(acc + k * SIMD_LANES, lo[k]);
+    _mm256_storeu_ps(acc + k * SIMD_LANES + 8, hi[k]);
+  }
+}
+
+/* labelsums_avx512: one register per label, masked adds */
+__attribute__((target("avx512f")))
+static void labelsums_avx512(const int * labels, const float * num, const float * den,
+			     int n, int nlabels, float * acc)
+{
+  __m512 sum[SIMD_MAXLABELS];
+  int k, j;
+  for (k = 0; k < nlabels; ++k)
+    sum[k] = _mm512_loadu_ps(acc + k * SIMD_LANES);
+  const __m512 zero = _mm512_setzero_ps();
+  for (j = 0; j < n; j += SIMD_LANES) {
+    __m512i l = _mm512_loadu_si512((const void *) (labels + j));
+    __m512 d = _mm512_loadu_ps(den + j);
+    __mmask16 nonzero = _mm512_cmp_ps_mask(d, zero, _CMP_NEQ_OQ);
+    __m512 v = _mm512_maskz_div_ps(nonzero, _mm512_loadu_ps(num + j), d);
+    for (k = 0; k < nlabels; ++k) {
+      __mmask16 m = _mm512_cmpeq_epi32_mask(l, _mm512_set1_epi32(k)) & nonzero;
+      sum[k] = _mm512_mask_add_ps(sum[k], m, sum[k], v);
+    }
+  }
+  for (k = 0; k < nlabels; ++k)
+    _mm512_storeu_ps(acc + k * SIMD_LANES, sum[k]);
+}
+
+/* fixedsums_scalar: n sources */
+static void fixedsums_scalar(const int * labels, const unsigned int * num, const unsigned int * kern,
+			     int n, unsigned long long * acc)
+{
+  int j;
+  for (j = 0; j < n; ++j)
+    if (labels[j] >= 0)
+      acc[labels[j]] += (unsigned long long) num[j] * kern[j];
+}
+
+/* fixedsums_avx2: 8 sources at a time, the even and odd 32-bit lanes
+   multiplied into 64 bits separately; other labels have num masked to 0 */
+__attribute__((target("avx2")))
+static void fixedsums_avx2(const int * labels, const unsigned int * num, const unsigned int * kern,
+			   int n, int nlabels, unsigned long long * acc)
+{
+  __m256i sum[SIMD_MAXLABELS];
+  int k, j;
+  for (k = 0; k < nlabels; ++k)
+    sum[k] = _mm256_setzero_si256();
+  for (j = 0; j < n; j += 8) {
+    __m256i l = _mm256_loadu_si256((const __m256i *) (labels + j));
+    __m256i s = _mm256_loadu_si256((const __m256i *) (num + j));
+    __m256i w = _mm256_loadu_si256((const __m256i *) (kern + j));
+    __m256i wodd = _mm256_srli_epi64(w, 32);
+    for (k = 0; k < nlabels; ++k) {
+      __m256i sk = _mm256_and_si256(s, _mm256_cmpeq_epi32(l, _mm256_set1_epi32(k)));
+      __m256i even = _mm256_mul_epu32(sk, w);
+      __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(sk, 32), wodd);
+      sum[k] = _mm256_add_epi64(sum[k], _mm256_add_epi64(even, odd));
+    }
+  }
+  for (k = 0; k < nlabels; ++k) {
+    unsigned long long lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, sum[k]);
+    acc[k] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+}
+
+/* fixedsums_avx512: as fixedsums_avx2, 16 sources at a time */
+__attribute__((target("avx512f")))
+static void fixedsums_avx512(const int * labels, const unsigned int * num, const unsigned int * kern,
+			     int n, int nlabels, unsigned long long * acc)
+{
+  __m512i sum[SIMD_MAXLABELS];
+  int k, j;
+  for (k = 0; k < nlabels; ++k)
+    sum[k] = _mm512_setzero_si512();
+  for (j = 0; j < n; j += SIMD_LANES) {
+    __m512i l = _mm512_loadu_si512((const void *) (labels + j));
+    __m512i s = _mm512_loadu_si512((const void *) (num + j));
+    __m512i w = _mm512_loadu_si512((const void *) (kern + j));
+    __m512i wodd = _mm512_srli_epi64(w, 32);
+    for (k = 0; k < nlabels; ++k) {
+      __m512i sk = _mm512_maskz_mov_epi32(_mm512_cmpeq_epi32_mask(l, _mm512_set1_epi32(k)), s);
+      __m512i even = _mm512_mul_epu32(sk, w);
+      __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(sk, 32), wodd);
+      sum[k] = _mm512_add_epi64(sum[k], _mm512_add_epi64(even, odd));
+    }
+  }
+  for (k = 0; k < nlabels; ++k)
+    acc[k] += _mm512_reduce_add_epi64(sum[k]);
+}
@@ -0,0 +1,40 @@
+/*
+ * simd.h
+ * masked per-label accumulation for small label counts, in AVX-512,
+ * AVX2 or scalar code chosen at run time
+ * maarten
+ *
+ * simd_labelsums() adds num[j] / den[j] into the accumulator of label
+ * labels[j], skipping labels below 0 and den[j] == 0. Source j goes to
+ * lane j % SIMD_LANES of its label, acc[label * SIMD_LANES + lane], and
+ * simd_lanesum() adds the lanes up in lane order. All variants do the
+ * same float operations in the same order, so they give the same sums.
+ *
+ * simd_fixedsums() adds num[j] * kern[j] into acc[labels[j]] in 64-bit
+ * integers, skipping labels below 0; the caller keeps the sums below
+ * 2^64. Integer sums do not depend on the order they are added in, so
+ * the variants, and any split of the sources over rows or threads, give
+ * the same sums. Above SIMD_MAXLABELS labels only the scalar code runs.
+ */
+
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#define SIMD_LANES 16
+#define SIMD_MAXLABELS 8
+
+#define SIMD_SCALAR 0
+#define SIMD_AVX2 1
+#define SIMD_AVX512 2
+
+#ifndef SIMD_MAXLEVEL
+#define SIMD_MAXLEVEL SIMD_AVX512 /* highest variant dispatched to */
+#endif
+
+int simd_level(void);
+void simd_labelsums(int, const int *, const float *, const float *, int, int, float *);
+void simd_lanesum(const float *, int, float *);
+void simd_fixedsums(int, const int *, const unsigned int *, const unsigned int *, int, int,
+		    unsigned long long *);
+
+#endif /* SIMD_H_ */
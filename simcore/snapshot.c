@@ -0,0 +1,160 @@
+/*
+ * snapshot.c
+ * initial states in memory-mapped files, see snapshot.h
+ * maarten
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC 0x31504e53 /* "SNP1" */
+
+typedef struct {
+  uint32_t magic;
+  int32_t nkey;
+  int32_t key[SNAPSHOT_MAXKEY];
+  int32_t aux[SNAPSHOT_MAXAUX];
+  uint64_t bytes;
+} SnapHeader;
+
+/* prototypes */
+static char * mapfile(const char *, size_t, int);
+static int mapvalid(Snapshot *);
+static void unlock(Snapshot *);
+
+/* snapshot_open: the snapshot at path if its key and size match, else a
+   fresh one to generate into */
+Snapshot * snapshot_open(const char * path, const int * key, int nkey, size_t bytes)
+{
+  Snapshot * snap = (Snapshot *) calloc(1, sizeof(Snapshot));
+  if (!snap || nkey > SNAPSHOT_MAXKEY) {
+    fprintf(stderr,"Snapshot: allocation failure or key too long.\n");
+    exit(EXIT_FAILURE);
+  }
+  snap -> bytes = bytes;
+  snap -> nkey = nkey;
+  memcpy(snap -> key, key, nkey * sizeof(int));
+  snap -> path = strdup(path);
+  snap -> lockfd = -1;
+  if (mapvalid(snap))
+    return snap;
+  // one process generates, the others wait on the lock and map its file
+  char lock[strlen(path) + 8];
+  sprintf(lock, "%s.lock", path);
+  snap -> lockfd = open(lock, O_RDWR | O_CREAT, 0644);
+  if (snap -> lockfd < 0 || flock(snap -> lockfd, LOCK_EX)) {
+    perror(lock);
+    exit(EXIT_FAILURE);
+  }
+  if (mapvalid(snap)) {
+    unlock(snap);
+    return snap;
+  }
+  // generate into a shared mapping of a temporary file of our own
+  snap -> tmp = (char *) malloc(strlen(path) + 8);
+  sprintf(snap -> tmp, "%s.XXXXXX", path);
+  int fd = mkstemp(snap -> tmp);
+  if (fd < 0 || fchmod(fd, 0644) || ftruncate(fd, SNAPSHOT_HEADER + bytes)) {
+    perror(snap -> tmp);
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+  snap -> base = mapfile(snap -> tmp, SNAPSHOT_HEADER + bytes, MAP_SHARED);
+  snap -> data = snap -> base + SNAPSHOT_HEADER;
+  snap -> fresh = 1;
+  return snap;
+}
+
+/* snapshot_seal: write the header of a fresh snapshot, publish it and map
+   it copy-on-write at the same data */
+void snapshot_seal(Snapshot * snap)
+{
+  if (!snap -> fresh)
+    return;
+  SnapHeader * h = (SnapHeader *) snap -> base;
+  h -> nkey = snap -> nkey;
+  memcpy(h -> key, snap -> key, snap -> nkey * sizeof(int));
+  memcpy(h -> aux, snap -> aux, sizeof(h -> aux));
+  h -> bytes = snap -> bytes;
+  if (msync(snap -> base, SNAPSHOT_HEADER + snap -> bytes, MS_SYNC) == 0) {
+    h -> magic = SNAPSHOT_MAGIC;
+    msync(snap -> base, SNAPSHOT_HEADER, MS_SYNC);
+  }
+  munmap(snap -> base, SNAPSHOT_HEADER + snap -> bytes);
+  snap -> fresh = 0;
+  // a valid file that appeared meanwhile, e.g. where flock() does not
+  // reach, holds the same data: keep it and drop ours
+  if (mapvalid(snap))
+    unlink(snap -> tmp);
+  else if (rename(snap -> tmp, snap -> path) || !mapvalid(snap)) {
+    perror(snap -> path);
+    exit(EXIT_FAILURE);
+  }
+  unlock(snap);
+}
+
+void snapshot_close(Snapshot * snap)
+{
+  if (!snap)
+    return;
+  munmap(snap -> base, SNAPSHOT_HEADER + snap -> bytes);
+  unlock(snap);
+  free(snap -> tmp);
+  free(snap -> path);
+  free(snap);
+}
+
+/* mapvalid: map the file at the path copy-on-write if its header
+   matches, 1 if it did */
+static int mapvalid(Snapshot * snap)
+{
+  struct stat st;
+  size_t len = SNAPSHOT_HEADER + snap -> bytes;
+  if (stat(snap -> path, &st) || (size_t) st.st_size != len)
+    return 0;
+  char * base = mapfile(snap -> path, len, MAP_PRIVATE);
+  SnapHeader * h = (SnapHeader *) base;
+  if (h -> magic != SNAPSHOT_MAGIC || h -> nkey != snap -> nkey || h -> bytes != snap -> bytes
+      || memcmp(h -> key, snap -> key, snap -> nkey * sizeof(int))) {
+    munmap(base, len);
+    return 0;
+  }
+  memcpy(snap -> aux, h -> aux, sizeof(snap -> aux));
+  snap -> base = base;
+  snap -> data = base + SNAPSHOT_HEADER;
+  return 1;
+}
+
+/* unlock: let the next generating process in */
+static void unlock(Snapshot * snap)
+{
+  if (snap -> lockfd >= 0) {
+    flock(snap -> lockfd, LOCK_UN);
+    close(snap -> lockfd);
+    snap -> lockfd = -1;
+  }
+}
+
+/* mapfile: map bytes of path, MAP_SHARED or MAP_PRIVATE */
+static char * mapfile(const char * path, size_t bytes, int flags)
+{
+  int fd = open(path, (flags == MAP_SHARED) ? O_RDWR : O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  char * p = (char *) mmap(NULL, bytes, PROT_READ | PROT_WRITE, flags, fd, 0);
+  if (p == MAP_FAILED) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+  return p;
+}
@@ -0,0 +1,44 @@
+/*
+ * snapshot.h
+ * initial states in memory-mapped files, generated once and mapped by
+ * every later run with the same key
+ * maarten
+ *
+ * A snapshot is a header page and the data. snapshot_open() maps an
+ * existing file copy-on-write, so its pages are read in as the run first
+ * touches them and the run's own writes stay private; without a valid
+ * file it maps a fresh one to generate into, which snapshot_seal() then
+ * publishes under the name and maps copy-on-write in turn. The header is
+ * written last: a file left behind by a crashed generation never matches.
+ * Generation holds an flock() on <path>.lock and writes a temporary file
+ * of its own, so concurrent runs wait for one generator and map its file.
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SNAPSHOT_HEADER 4096 /* a page, so the data starts page-aligned */
+#define SNAPSHOT_MAXKEY 32
+#define SNAPSHOT_MAXAUX 8
+
+typedef struct {
+  char * base;     /* header page, then the data */
+  size_t bytes;    /* of the data */
+  void * data;
+  int fresh;       /* fill data and aux, then snapshot_seal() */
+  int aux[SNAPSHOT_MAXAUX]; /* model values kept with the data */
+  int key[SNAPSHOT_MAXKEY];
+  int nkey;
+  char * path;
+  char * tmp;      /* the file a fresh snapshot is generated into */
+  int lockfd;      /* held while generating, else -1 */
+} Snapshot;
+
+Snapshot * snapshot_open(const char *, const int *, int, size_t);
+void snapshot_seal(Snapshot *);
+void snapshot_close(Snapshot *);
+
+#endif /* SNAPSHOT_H_ */
@@ -0,0 +1,185 @@
+/*
+ * socdiff.c
+ * differential runner: a candidate simulator against the reference build
+ * over parameter sets and seeds, exact or statistical comparison
+ * maarten
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "runner.h"
+#include "stats.h"
+
+#define ALPHA 0.01 /* family-wise level per parameter set */
+#define NAME_BUF_SIZE 512
+
+static int max0(int);
+static int compareexact(Run *, Run *, char *);
+
+int main(int argc, char * argv[])
+{
+  if (argc < 6) {
+    printf("\nsocdiff: compare a simulator against its reference build.\n");
+    printf("\t1. Mode (0: exact 1: statistical)\n");
+    printf("\t2. Number of seeds (seeds 1..n)\n");
+    printf("\t3. Reference binary\n");
+    printf("\t4. Candidate binary, extra candidate arguments may follow in the same string\n");
+    printf("\t5. Parameter set: the model arguments after the report path,\n");
+    printf("\t   the seed (third) is replaced; more sets may follow\n\n");
+    return 0;
+  }
+  int mode = atoi(argv[1]);
+  int nseeds = atoi(argv[2]);
+  if (nseeds < 1 || (mode && nseeds < 2)) {
+    fprintf(stderr,"Need at least %d seeds\n",mode ? 2 : 1);
+    exit(EXIT_FAILURE);
+  }
+  char * refargs[RUN_MAXARGS], * candargs[RUN_MAXARGS];
+  int nref = run_splitargs(argv[3], refargs, RUN_MAXARGS);
+  int ncand = run_splitargs(argv[4], candargs, RUN_MAXARGS);
+
+  int failures = 0;
+  int p;
+  for (p = 5; p < argc; ++p) {
+    char * params[RUN_MAXARGS];
+    char * line = strdup(argv[p]);
+    int nparams = run_splitargs(line, params, RUN_MAXARGS);
+    if (nparams < 3) {
+      fprintf(stderr,"Parameter set needs at least size, steps and seed: %s\n",argv[p]);
+      exit(EXIT_FAILURE);
+    }
+    Run * ref = (Run *) calloc(nseeds, sizeof(Run));
+    Run * cand = (Run *) calloc(nseeds, sizeof(Run));
+    double reftime = 0.0, candtime = 0.0;
+    int s;
+    for (s = 0; s < nseeds; ++s) {
+      run_model(refargs, nref, params, nparams, s + 1, &ref[s]);
+      run_model(candargs, ncand, params, nparams, s + 1, &cand[s]);
+      reftime += ref[s].seconds;
+      candtime += cand[s].seconds;
+    }
+    printf("Parameters:\t%s\n",argv[p]);
+    printf("Seeds:\t\t%d\n",nseeds);
+    printf("Reference:\t%.3f s\n",reftime);
+    printf("Candidate:\t%.3f s\n",candtime);
+    printf("Speedup:\t%.2fx\n",(candtime > 0.0) ? reftime / candtime : 0.0);
+
+    int ok = 1;
+    if (mode == 0) {
+      char where[NAME_BUF_SIZE];
+      for (s = 0; s < nseeds && ok; ++s) {
+	if (!compareexact(&ref[s], &cand[s], where)) {
+	  printf("Exact:\t\tDIFF seed %d, %s\n",s + 1,where);
+	  ok = 0;
+	}
+      }
+      if (ok)
+	printf("Exact:\t\tOK\n");
+    } else {
+      // final report values and every short report column mean
+      int ncols = ref[0].ncols;
+      for (s = 0; s < nseeds; ++s)
+	if (ref[s].ncols != ncols || cand[s].ncols != ncols) {
+	  printf("Columns:\tDIFF seed %d, %d against %d\n",s + 1,ref[s].ncols,cand[s].ncols);
+	  ok = 0;
+	  ncols = 0;
+	  break;
+	}
+      int nmetrics = 2 + max0(ncols - 1);
+      double * a = (double *) malloc(nseeds * sizeof(double));
+      double * b = (double *) malloc(nseeds * sizeof(double));
+      int m;
+      printf("%-16s%12s%12s%10s%10s\n","Metric","Reference","Candidate","p(t)","p(KS)");
+      for (m = 0; m < nmetrics; ++m) {
+	char name[32];
+	double ma = 0.0, mb = 0.0;
+	for (s = 0; s < nseeds; ++s) {
+	  switch(m) {
+	  case 0:
+	    a[s] = ref[s].nchanges;
+	    b[s] = cand[s].nchanges;
+	    break;
+	  case 1:
+	    a[s] = ref[s].homogeneity;
+	    b[s] = cand[s].homogeneity;
+	    break;
+	  default:
+	    a[s] = ref[s].colmean[m - 1];
+	    b[s] = cand[s].colmean[m - 1];
+	    break;
+	  }
+	  ma += a[s];
+	  mb += b[s];
+	}
+	if (m == 0)
+	  strcpy(name, "nchanges");
+	else if (m == 1)
+	  strcpy(name, "homogeneity");
+	else
+	  sprintf(name, "short col %d", m - 1);
+	double pt = stats_welch(a, b, nseeds);
+	double pks = stats_ks2(a, b, nseeds);
+	int pass = (pt >= ALPHA / nmetrics && pks >= ALPHA / nmetrics);
+	printf("%-16s%12.4f%12.4f%10.4f%10.4f%s\n",name,ma / nseeds,mb / nseeds,pt,pks,pass ? "" : "\tDIFF");
+	ok = ok && pass;
+      }
+      printf("Statistical:\t%s (alpha %.3f over %d metrics)\n",ok ? "OK" : "DIFF",ALPHA,nmetrics);
+      free(a);
+      free(b);
+    }
+    printf("\n");
+    failures += !ok;
+    for (s = 0; s < nseeds; ++s) {
+      run_free(&ref[s]);
+      run_free(&cand[s]);
+    }
+    free(ref);
+    free(cand);
+    free(line);
+  }
+  return failures ? EXIT_FAILURE : 0;
+}
+
+/* max0: clamp at zero */
+static int max0(int n)
+{
+  return (n > 0) ? n : 0;
+}
+
+/* compareexact: short reports byte for byte, numbered final report lines
+   of the reference against the same lines of the candidate; engine or
+   timing lines the candidate adds are ignored */
+static int compareexact(Run * ref, Run * cand, char * where)
+{
+  char * a = ref -> short_report, * b = cand -> short_report;
+  int line = 1;
+  while (*a && *a == *b) {
+    if (*a == '\n')
+      line++;
+    a++;
+    b++;
+  }
+  if (*a || *b) {
+    sprintf(where, "short report line %d", line);
+    return 0;
+  }
+  a = ref -> final_report;
+  b = cand -> final_report;
+  line = 1;
+  while (*a) {
+    char * ea = strchr(a, '\n'), * eb = strchr(b, '\n');
+    size_t la = ea ? ea - a : strlen(a);
+    size_t lb = eb ? eb - b : strlen(b);
+    if (*a >= '0' && *a <= '9' && (la != lb || strncmp(a, b, la))) {
+      sprintf(where, "final report line %d", line);
+      return 0;
+    }
+    if (!ea)
+      break;
+    a = ea + 1;
+    b = eb ? eb + 1 : b + lb;
+    line++;
+  }
+  return 1;
+}
@@ -0,0 +1,304 @@
+/*
+ * socexplore.c
+ * adaptive exploration of up to three model parameters: a coarse grid
+ * first, then rounds of runs placed where a nearest neighbour surrogate
+ * of the final report metrics changes fastest or has no runs nearby,
+ * until the run budget is spent
+ * maarten
+ *
+ * Points live in the unit cube, scaled to the parameter ranges at run
+ * time. A candidate scores the spread of the scaled metrics over its
+ * nearest runs, plus a floor for unexplored flat regions, times its
+ * distance to the nearest run: regions where the metrics jump get
+ * filled in, flat ones only thinly. A round takes the best candidates
+ * one at a time, each counting as a run for the next, so a round spreads
+ * over the transitions instead of piling onto the steepest one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "runner.h"
+
+#define EXPLORE_MAXDIMS 3
+#define EXPLORE_NEIGHBOURS 4   /* runs the surrogate looks at */
+#define EXPLORE_CANDIDATES 512 /* random candidates per pick */
+#define EXPLORE_FLOOR 0.1      /* weight of distance alone, flat regions */
+#define EXPLORE_STEEPEST 5     /* runs listed as nearest the transitions */
+#define NMETRICS 2
+
+typedef struct {
+  int arg[EXPLORE_MAXDIMS]; /* parameter set index of each dimension */
+  double lo[EXPLORE_MAXDIMS];
+  double hi[EXPLORE_MAXDIMS];
+  int ndims;
+} Space;
+
+typedef struct {
+  double u[EXPLORE_MAXDIMS]; /* position in the unit cube */
+  double y[NMETRICS];
+  int round;
+  int done;
+  double spread; /* of the metrics over its neighbours, at the end */
+} Point;
+
+static char * metricnames[NMETRICS] = {"nchanges", "homogeneity"};
+
+static void setparams(Space *, Point *, char **, char **, char (*)[32]);
+static double dist2(Space *, double *, double *);
+static double spread(Space *, Point *, int, double *, double *, double *);
+static void ranges(Point *, int, double *);
+static int cmp_spread(const void *, const void *);
+
+int main(int argc, char * argv[])
+{
+  if (argc < 5 || argc > 4 + EXPLORE_MAXDIMS) {
+    printf("\nsocexplore: adaptive exploration of parameter space.\n");
+    printf("\t1. Simulator binary, extra arguments may follow in the same string\n");
+    printf("\t2. Run budget\n");
+    printf("\t3. Parameter set: the model arguments after the report path\n");
+    printf("\t4. Dimension \"arg:low:high\", arg numbered as in the simulator's\n");
+    printf("\t   usage (socimpact bias 11, socinter c 7); up to %d dimensions\n\n",EXPLORE_MAXDIMS);
+    return 0;
+  }
+  char * bin[RUN_MAXARGS];
+  int nbin = run_splitargs(argv[1], bin, RUN_MAXARGS);
+  int budget = atoi(argv[2]);
+  char * base[RUN_MAXARGS];
+  int nparams = run_splitargs(strdup(argv[3]), base, RUN_MAXARGS);
+  if (nparams < 3) {
+    fprintf(stderr,"Parameter set needs at least size, steps and seed: %s\n",argv[3]);
+    exit(EXIT_FAILURE);
+  }
+  int seed = atoi(base[2]);
+  Space space;
+  space.ndims = argc - 4;
+  int d;
+  for (d = 0; d < space.ndims; ++d) {
+    int arg;
+    if (sscanf(argv[4 + d], "%d:%lf:%lf", &arg, &space.lo[d], &space.hi[d]) != 3
+	|| arg - 2 < 0 || arg - 2 >= nparams || arg - 2 == 2) {
+      fprintf(stderr,"Illegal dimension: %s\n",argv[4 + d]);
+      exit(EXIT_FAILURE);
+    }
+    space.arg[d] = arg - 2;
+  }
+  int maxjobs = sysconf(_SC_NPROCESSORS_ONLN);
+  if (maxjobs < 1)
+    maxjobs = 1;
+
+  // coarse design: a grid of 3 levels per dimension, 2 if that is more
+  // than half the budget
+  int levels = 3, ngrid = 1;
+  for (d = 0; d < space.ndims; ++d)
+    ngrid *= levels;
+  if (ngrid > budget / 2) {
+    levels = 2;
+    ngrid = 1 << space.ndims;
+  }
+  if (ngrid > budget) {
+    fprintf(stderr,"Budget %d is below the %d runs of the coarse grid\n",budget,ngrid);
+    exit(EXIT_FAILURE);
+  }
+  Point * points = (Point *) calloc(budget, sizeof(Point));
+  int npoints, k;
+  for (npoints = 0; npoints < ngrid; ++npoints) {
+    k = npoints;
+    for (d = 0; d < space.ndims; ++d) {
+      points[npoints].u[d] = (double) (k % levels) / (levels - 1);
+      k /= levels;
+    }
+  }
+
+  RunJob * jobs = (RunJob *) calloc(maxjobs, sizeof(RunJob));
+  Run * runs = (Run *) calloc(maxjobs, sizeof(Run));
+  int * jobpoint = (int *) malloc(maxjobs * sizeof(int));
+  char (*values)[EXPLORE_MAXDIMS][32] = malloc(maxjobs * sizeof(*values));
+  unsigned short xsubi[3] = {0x5eed, (unsigned short) seed, 0x0c0a};
+  int first = 0, round = 0;
+  while (1) {
+    // run points first..npoints-1, up to maxjobs at a time
+    int next = first, running = 0, j;
+    for (j = 0; j < maxjobs; ++j)
+      jobs[j].pid = 0;
+    while (next < npoints || running > 0) {
+      if (next < npoints && running < maxjobs) {
+	for (j = 0; jobs[j].pid; ++j)
+	  ;
+	char * params[RUN_MAXARGS];
+	memcpy(params, base, nparams * sizeof(char *));
+	setparams(&space, &points[next], params, base, values[j]);
+	jobpoint[j] = next;
+	points[next].round = round;
+	run_start(&jobs[j], bin, nbin, params, nparams, seed, &runs[j]);
+	next++;
+	running++;
+	continue;
+      }
+      RunJob * job = run_wait(jobs, maxjobs);
+      j = job - jobs;
+      Point * pt = &points[jobpoint[j]];
+      pt -> y[0] = runs[j].nchanges;
+      pt -> y[1] = runs[j].homogeneity;
+      pt -> done = 1;
+      run_free(&runs[j]);
+      running--;
+    }
+    printf("Round %d: %d runs, %d of %d used\n",round,npoints - first,npoints,budget);
+    round++;
+    first = npoints;
+    if (npoints == budget)
+      break;
+
+    // pick the next round one candidate at a time against the surrogate
+    // of the finished runs; picks count as runs for the distances
+    double yscale[NMETRICS];
+    ranges(points, npoints, yscale);
+    int nround = (budget - npoints < maxjobs) ? budget - npoints : maxjobs;
+    for (k = 0; k < nround; ++k) {
+      double best = -1.0, bestu[EXPLORE_MAXDIMS] = {0.0};
+      int c;
+      for (c = 0; c < EXPLORE_CANDIDATES; ++c) {
+	double u[EXPLORE_MAXDIMS] = {0.0}, nearest;
+	for (d = 0; d < space.ndims; ++d)
+	  u[d] = erand48(xsubi);
+	double s = spread(&space, points, npoints, u, yscale, &nearest);
+	int p;
+	for (p = first; p < npoints; ++p)
+	  nearest = fmin(nearest, sqrt(dist2(&space, u, points[p].u)));
+	double score = (s + EXPLORE_FLOOR) * nearest;
+	if (score > best) {
+	  best = score;
+	  memcpy(bestu, u, sizeof(bestu));
+	}
+      }
+      memcpy(points[npoints].u, bestu, sizeof(bestu));
+      npoints++;
+    }
+  }
+
+  // the run table, then the runs nearest the transitions
+  double yscale[NMETRICS];
+  ranges(points, npoints, yscale);
+  int p, m;
+  printf("\n%6s","round");
+  for (d = 0; d < space.ndims; ++d)
+    printf("%11s%-3d"," arg ",space.arg[d] + 2);
+  for (m = 0; m < NMETRICS; ++m)
+    printf("%14s",metricnames[m]);
+  printf("%10s\n","spread");
+  for (p = 0; p < npoints; ++p) {
+    double nearest;
+    points[p].spread = spread(&space, points, npoints, points[p].u, yscale, &nearest);
+  }
+  Point ** order = (Point **) malloc(npoints * sizeof(Point *));
+  for (p = 0; p < npoints; ++p)
+    order[p] = &points[p];
+  for (k = 0; k < 2; ++k) {
+    if (k == 1) {
+      qsort(order, npoints, sizeof(Point *), cmp_spread);
+      printf("\nSteepest:\n");
+    }
+    for (p = 0; p < ((k == 1 && npoints > EXPLORE_STEEPEST) ? EXPLORE_STEEPEST : npoints); ++p) {
+      Point * pt = order[p];
+      printf("%6d",pt -> round);
+      for (d = 0; d < space.ndims; ++d)
+	printf("%14.4f",space.lo[d] + pt -> u[d] * (space.hi[d] - space.lo[d]));
+      for (m = 0; m < NMETRICS; ++m)
+	printf("%14.4f",pt -> y[m]);
+      printf("%10.3f\n",pt -> spread);
+    }
+  }
+  printf("Runs used:\t%d\n",npoints);
+  return 0;
+}
+
+/* setparams: the parameter set of a point, values formatted into buf */
+static void setparams(Space * space, Point * pt, char ** params, char ** base, char (*buf)[32])
+{
+  int d;
+  for (d = 0; d < space -> ndims; ++d) {
+    double v = space -> lo[d] + pt -> u[d] * (space -> hi[d] - space -> lo[d]);
+    if (strpbrk(base[space -> arg[d]], ".eE"))
+      snprintf(buf[d], 32, "%.6g", v);
+    else
+      snprintf(buf[d], 32, "%d", (int) lround(v));
+    params[space -> arg[d]] = buf[d];
+  }
+}
+
+/* dist2: squared distance in the unit cube */
+static double dist2(Space * space, double * u, double * v)
+{
+  double s = 0.0;
+  int d;
+  for (d = 0; d < space -> ndims; ++d)
+    s += (u[d] - v[d]) * (u[d] - v[d]);
+  return s;
+}
+
+/* spread: the surrogate at u, largest range of a scaled metric over the
+   nearest finished runs, u itself excluded; nearest gets the distance to
+   the nearest of them */
+static double spread(Space * space, Point * points, int npoints, double * u, double * yscale, double * nearest)
+{
+  int nn[EXPLORE_NEIGHBOURS];
+  double dd[EXPLORE_NEIGHBOURS];
+  int n = 0, p, k;
+  for (p = 0; p < npoints; ++p) {
+    if (!points[p].done)
+      continue;
+    double d = dist2(space, u, points[p].u);
+    if (d == 0.0)
+      continue;
+    // insertion into the sorted neighbour list
+    for (k = n; k > 0 && dd[k - 1] > d; --k)
+      if (k < EXPLORE_NEIGHBOURS) {
+	dd[k] = dd[k - 1];
+	nn[k] = nn[k - 1];
+      }
+    if (k < EXPLORE_NEIGHBOURS) {
+      dd[k] = d;
+      nn[k] = p;
+      if (n < EXPLORE_NEIGHBOURS)
+	n++;
+    }
+  }
+  *nearest = (n > 0) ? sqrt(dd[0]) : 1.0;
+  double s = 0.0;
+  int m;
+  for (m = 0; m < NMETRICS; ++m) {
+    double lo = INFINITY, hi = -INFINITY;
+    for (k = 0; k < n; ++k) {
+      lo = fmin(lo, points[nn[k]].y[m]);
+      hi = fmax(hi, points[nn[k]].y[m]);
+    }
+    if (n > 0)
+      s = fmax(s, (hi - lo) / yscale[m]);
+  }
+  return s;
+}
+
+/* ranges: range of each metric over the finished runs, 0 counts as 1 */
+static void ranges(Point * points, int npoints, double * yscale)
+{
+  int m, p;
+  for (m = 0; m < NMETRICS; ++m) {
+    double lo = INFINITY, hi = -INFINITY;
+    for (p = 0; p < npoints; ++p)
+      if (points[p].done) {
+	lo = fmin(lo, points[p].y[m]);
+	hi = fmax(hi, points[p].y[m]);
+      }
+    yscale[m] = (hi > lo) ? hi - lo : 1.0;
+  }
+}
+
+static int cmp_spread(const void * vp1, const void * vp2)
+{
+  double s1 = (*(Point * const *) vp1) -> spread;
+  double s2 = (*(Point * const *) vp2) -> spread;
+  return (s1 < s2) - (s1 > s2);
+}
@@ -0,0 +1,119 @@
+/*
+ * socmon.c
+ * the live metrics of all runs on this node, see metrics.h
+ * maarten
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "metrics.h"
+#include "eventlog.h"
+
+#define SHM_DIR "/dev/shm" /* where shm_open() segments show up */
+
+static void scan(int);
+static void printrun(MetricsBlock *, double);
+
+int main(int argc, char * argv[])
+{
+  int prune = 0, interval = 0, a;
+  for (a = 1; a < argc; ++a) {
+    if (strcmp(argv[a], "-p") == 0)
+      prune = 1;
+    else if (atoi(argv[a]) > 0)
+      interval = atoi(argv[a]);
+    else {
+      printf("\nsocmon: live metrics of the runs on this node.\n");
+      printf("\t-p  remove the segments of runs that died\n");
+      printf("\t1. Refresh interval in seconds (optional, default: once)\n\n");
+      return 0;
+    }
+  }
+  do {
+    if (interval)
+      printf("\033[H\033[J");
+    scan(prune);
+    fflush(stdout);
+  } while (interval && sleep(interval) == 0);
+  return 0;
+}
+
+/* scan: one table over all segments, then the totals */
+static void scan(int prune)
+{
+  DIR * dir = opendir(SHM_DIR);
+  if (!dir) {
+    perror(SHM_DIR);
+    exit(EXIT_FAILURE);
+  }
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  double now = ts.tv_sec + ts.tv_nsec / 1e9;
+  printf("%8s %-9s %15s %9s %9s %6s %7s %7s %6s  %s\n",
+	 "pid","model","step","steps/s","eta s","kern%","mostfr","homog","age s","run");
+  int nruns = 0, ndead = 0;
+  double rate = 0.0;
+  struct dirent * de;
+  while ((de = readdir(dir))) {
+    if (strncmp(de -> d_name, METRICS_PREFIX + 1, strlen(METRICS_PREFIX) - 1) != 0)
+      continue;
+    char name[300];
+    snprintf(name, sizeof(name), "/%s", de -> d_name);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+      continue;
+    MetricsBlock * b = (MetricsBlock *) mmap(NULL, sizeof(MetricsBlock), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (b == MAP_FAILED)
+      continue;
+    MetricsBlock copy;
+    int ok = metrics_read(b, &copy);
+    munmap(b, sizeof(MetricsBlock));
+    if (!ok)
+      continue;
+    if (kill(copy.pid, 0) != 0 && errno == ESRCH) {
+      ndead++;
+      if (prune)
+	shm_unlink(name);
+      continue;
+    }
+    printrun(&copy, now);
+    nruns++;
+    rate += copy.stepspersec;
+  }
+  closedir(dir);
+  printf("Runs: %d, %.2f steps/s together",nruns,rate);
+  if (ndead)
+    printf(", %d dead segment%s%s",ndead,(ndead > 1) ? "s" : "",prune ? " removed" : " (-p removes)");
+  printf("\n");
+}
+
+/* printrun: one line, the label cut to its file name */
+static void printrun(MetricsBlock * b, double now)
+{
+  char steps[32];
+  snprintf(steps, sizeof(steps), "%d/%d", b -> currentstep, b -> nsteps);
+  double eta = (b -> stepspersec > 0.0) ? (b -> nsteps - b -> currentstep) / b -> stepspersec : 0.0;
+  double kern = (b -> elapsed > 0.0) ? 100.0 * b -> stepseconds / b -> elapsed : 0.0;
+  const char * label = strrchr(b -> label, '/');
+  label = label ? label + 1 : b -> label;
+  printf("%8d %-9s %15s %9.2f %9.0f %6.1f %7d %7.3f %6.0f  %s\n",
+	 b -> pid,
+	 (b -> model == MODEL_SOCIMPACT) ? "socimpact" : "socinter",
+	 steps,
+	 b -> stepspersec,
+	 eta,
+	 kern,
+	 b -> mostfrequent,
+	 b -> homogeneity,
+	 now - b -> updated,
+	 label);
+}
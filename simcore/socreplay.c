@@ -0,0 +1,68 @@
+/*
+ * socreplay.c
+ * reconstruct grids from a simulation event log
+ * prints grids in the long report format, one line per step
+ * maarten
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "eventlog.h"
+
+static void printgrid(EventReader *);
+
+int main(int argc, char * argv[])
+{
+  if (argc < 2 || argc > 3) {
+    printf("\nsocreplay: replay a simulation event log.\n");
+    printf("\t1. Event log\n");
+    printf("\t2. Step (optional, default: stream all steps)\n\n");
+    return 0;
+  }
+  EventReader * rd = eventreader_open(argv[1]);
+  if (!rd) {
+    fprintf(stderr,"Cannot read event log: %s\n",argv[1]);
+    exit(EXIT_FAILURE);
+  }
+  if (argc == 3) {
+    int step = atoi(argv[2]);
+    while (rd -> step < step && eventreader_next(rd))
+      ;
+    if (rd -> step != step) {
+      fprintf(stderr,"Step %d not in log (last step: %d)\n",step,rd -> step);
+      exit(EXIT_FAILURE);
+    }
+    printgrid(rd);
+  } else {
+    do
+      printgrid(rd);
+    while (eventreader_next(rd));
+  }
+  eventreader_close(rd);
+  return 0;
+}
+
+/* printgrid: one long report line */
+static void printgrid(EventReader * rd)
+{
+  int i;
+  for (i = 0; i < rd -> size * rd -> size; ++i) {
+    unsigned int * f = rd -> fields + i * rd -> nfields;
+    float status, item;
+    switch(rd -> model) {
+    case MODEL_SOCIMPACT:
+      printf("%d %d %d ", (int) f[1], (int) f[0], rd -> ages[i]);
+      break;
+    case MODEL_SOCINTER:
+      memcpy(&status, &f[0], sizeof(float));
+      memcpy(&item, &f[1], sizeof(float));
+      printf("%.3f %.3f %d ", status, item, rd -> ages[i]);
+      break;
+    default:
+      fprintf(stderr,"Unknown model in event log: %d\n",rd -> model);
+      exit(EXIT_FAILURE);
+    }
+  }
+  printf("\n");
+}
@@ -0,0 +1,229 @@
+/*
+ * socsweep.c
+ * parameter sweep with adaptive replicas: seeds are run in rounds and a
+ * point stops once the confidence intervals of its final report metrics
+ * are narrow enough; the budget left goes to the noisy points
+ * maarten
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "runner.h"
+#include "stats.h"
+
+#define SWEEP_MINREPS 4   /* replicas of every point in the first round */
+#define SWEEP_ALPHA 0.05  /* two sided, 95% intervals */
+#define NMETRICS 2
+
+typedef struct {
+  char * args;
+  char * params[RUN_MAXARGS];
+  int nparams;
+  int n; /* finished replicas */
+  int queued;
+  double mean[NMETRICS]; /* running mean and sum of squares, Welford */
+  double m2[NMETRICS];
+  int converged;
+} Point;
+
+static char * metricnames[NMETRICS] = {"nchanges", "homogeneity"};
+
+static void addrun(Point *, Run *);
+static double halfwidth(Point *, int);
+static int needed(Point *, double, double);
+static void printpoints(Point *, int, int);
+static int min_int(int, int);
+static int max_int(int, int);
+static double min_double(double, double);
+static double max_double(double, double);
+
+int main(int argc, char * argv[])
+{
+  if (argc < 6) {
+    printf("\nsocsweep: parameter sweep with adaptive replicas.\n");
+    printf("\t1. Simulator binary, extra arguments may follow in the same string\n");
+    printf("\t2. Relative precision: 95%% interval half width over |mean|\n");
+    printf("\t3. Absolute precision: half widths below this always suffice\n");
+    printf("\t4. Replica budget over all points\n");
+    printf("\t5. Parameter set: the model arguments after the report path,\n");
+    printf("\t   the seed (third) is replaced by 1, 2, ...; more sets may follow\n\n");
+    return 0;
+  }
+  char * bin[RUN_MAXARGS];
+  int nbin = run_splitargs(argv[1], bin, RUN_MAXARGS);
+  double relprec = atof(argv[2]);
+  double absprec = atof(argv[3]);
+  int budget = atoi(argv[4]);
+  int npoints = argc - 5;
+  int maxjobs = sysconf(_SC_NPROCESSORS_ONLN);
+  if (maxjobs < 1)
+    maxjobs = 1;
+
+  Point * points = (Point *) calloc(npoints, sizeof(Point));
+  int p;
+  for (p = 0; p < npoints; ++p) {
+    points[p].args = argv[5 + p];
+    char * line = strdup(argv[5 + p]);
+    points[p].nparams = run_splitargs(line, points[p].params, RUN_MAXARGS);
+    if (points[p].nparams < 3) {
+      fprintf(stderr,"Parameter set needs at least size, steps and seed: %s\n",argv[5 + p]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  RunJob * jobs = (RunJob *) calloc(maxjobs, sizeof(RunJob));
+  Run * runs = (Run *) calloc(maxjobs, sizeof(Run));
+  int * jobpoint = (int *) malloc(maxjobs * sizeof(int));
+  int * order = (int *) malloc((budget + npoints * SWEEP_MINREPS) * sizeof(int));
+  int used = 0, round = 0;
+  while (used < budget) {
+    // plan the round: the minimum first, then by remaining need
+    int nplanned = 0;
+    for (p = 0; p < npoints; ++p) {
+      Point * pt = &points[p];
+      pt -> queued = 0;
+      if (pt -> converged)
+	continue;
+      int want = (pt -> n < SWEEP_MINREPS) ? SWEEP_MINREPS - pt -> n : needed(pt, relprec, absprec);
+      pt -> queued = want;
+      nplanned += want;
+    }
+    if (nplanned == 0)
+      break;
+    int roundsize = min_int(budget - used, max_int(2 * maxjobs, npoints * SWEEP_MINREPS));
+    int nround = 0;
+    while (nround < roundsize && nplanned > 0) {
+      // hand out one replica to the point with the largest unmet need
+      int best = -1;
+      for (p = 0; p < npoints; ++p)
+	if (points[p].queued > 0 && (best < 0 || points[p].queued > points[best].queued))
+	  best = p;
+      order[nround++] = best;
+      points[best].queued--;
+      nplanned--;
+    }
+
+    // run the round, up to maxjobs at a time; seeds continue per point
+    int * nextseed = (int *) malloc(npoints * sizeof(int));
+    for (p = 0; p < npoints; ++p)
+      nextseed[p] = points[p].n + 1;
+    int next = 0, running = 0, j;
+    for (j = 0; j < maxjobs; ++j)
+      jobs[j].pid = 0;
+    while (next < nround || running > 0) {
+      if (next < nround && running < maxjobs) {
+	for (j = 0; jobs[j].pid; ++j)
+	  ;
+	Point * pt = &points[order[next]];
+	jobpoint[j] = order[next];
+	run_start(&jobs[j], bin, nbin, pt -> params, pt -> nparams, nextseed[order[next]]++, &runs[j]);
+	next++;
+	running++;
+	continue;
+      }
+      RunJob * done = run_wait(jobs, maxjobs);
+      int k = done - jobs;
+      addrun(&points[jobpoint[k]], &runs[k]);
+      run_free(&runs[k]);
+      running--;
+    }
+    free(nextseed);
+    used += nround;
+    round++;
+
+    for (p = 0; p < npoints; ++p) {
+      Point * pt = &points[p];
+      int m;
+      pt -> converged = pt -> n >= SWEEP_MINREPS;
+      for (m = 0; m < NMETRICS; ++m)
+	if (halfwidth(pt, m) > max_double(relprec * fabs(pt -> mean[m]), absprec))
+	  pt -> converged = 0;
+    }
+    printf("Round %d: %d replicas, %d of %d used\n",round,nround,used,budget);
+  }
+  printf("\n");
+  printpoints(points, npoints, used);
+
+  int open = 0;
+  for (p = 0; p < npoints; ++p)
+    open += !points[p].converged;
+  return open ? EXIT_FAILURE : 0;
+}
+
+/* min_int, max_int, min_double, max_double: the obvious */
+static int min_int(int a, int b)
+{
+  return (a < b) ? a : b;
+}
+
+static int max_int(int a, int b)
+{
+  return (a > b) ? a : b;
+}
+
+static double min_double(double a, double b)
+{
+  return (a < b) ? a : b;
+}
+
+static double max_double(double a, double b)
+{
+  return (a > b) ? a : b;
+}
+
+/* addrun: fold a finished replica into the point's running statistics */
+static void addrun(Point * pt, Run * run)
+{
+  double x[NMETRICS] = {run -> nchanges, run -> homogeneity};
+  pt -> n++;
+  int m;
+  for (m = 0; m < NMETRICS; ++m) {
+    double d = x[m] - pt -> mean[m];
+    pt -> mean[m] += d / pt -> n;
+    pt -> m2[m] += d * (x[m] - pt -> mean[m]);
+  }
+}
+
+/* halfwidth: of the t confidence interval of metric m */
+static double halfwidth(Point * pt, int m)
+{
+  if (pt -> n < 2)
+    return INFINITY;
+  double sd = sqrt(pt -> m2[m] / (pt -> n - 1));
+  return stats_tquantile(SWEEP_ALPHA, pt -> n - 1) * sd / sqrt(pt -> n);
+}
+
+/* needed: further replicas the point needs by its current variance */
+static int needed(Point * pt, double relprec, double absprec)
+{
+  double t = stats_tquantile(SWEEP_ALPHA, pt -> n - 1);
+  int need = 0, m;
+  for (m = 0; m < NMETRICS; ++m) {
+    double target = max_double(relprec * fabs(pt -> mean[m]), absprec);
+    double sd = sqrt(pt -> m2[m] / (pt -> n - 1));
+    double n = (target > 0.0) ? (t * sd / target) * (t * sd / target) : 1e9;
+    need = max_int(need, (int) ceil(min_double(n, 1e9)) - pt -> n);
+  }
+  return max_int(need, 1);
+}
+
+/* printpoints: final table, mean and half width per metric */
+static void printpoints(Point * points, int npoints, int used)
+{
+  int p, m;
+  printf("%-40s%6s","Parameters","n");
+  for (m = 0; m < NMETRICS; ++m)
+    printf("%14s%10s",metricnames[m],"+-");
+  printf("  %s\n","status");
+  for (p = 0; p < npoints; ++p) {
+    Point * pt = &points[p];
+    printf("%-40s%6d",pt -> args,pt -> n);
+    for (m = 0; m < NMETRICS; ++m)
+      printf("%14.4f%10.4f",pt -> mean[m],halfwidth(pt, m));
+    printf("  %s\n",pt -> converged ? "done" : "open");
+  }
+  printf("Replicas used:\t%d\n",used);
+}
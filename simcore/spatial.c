@@ -0,0 +1,212 @@
+/*
+ * spatial.c
+ * in-run spatial statistics over a labelled torus grid
+ * grid index i is at row i / size, column i % size
+ * maarten
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "spatial.h"
+
+#ifndef max
+#define max(a , b) ( ((a) > (b)) ? (a) : (b) )
+#endif /* max */
+
+#ifndef min
+#define min(a , b) ( ((a) < (b)) ? (a) : (b) )
+#endif /* min */
+
+/* prototypes */
+static int find(int *, int);
+static void unite(int *, int, int);
+static void clusters(int *, int, SpatialStats *);
+static void joins(int *, float *, int, SpatialStats *);
+static void radial(int *, int, int, SpatialStats *);
+
+/* spatialstats: fill stats for labels (0 <= label < nlabels) and values */
+void spatialstats(int * labels, float * values, int size, int nlabels, SpatialStats * stats)
+{
+  clusters(labels, size, stats);
+  joins(labels, values, size, stats);
+  radial(labels, size, nlabels, stats);
+}
+
+/* spatialstats_fprint: append the stats as short report columns */
+void spatialstats_fprint(FILE * fp, SpatialStats * stats)
+{
+  int r;
+  fprintf(fp,
+	  "\t%d\t%d\t%.3f\t%.3f\t%.3f",
+	  stats -> nclusters,
+	  stats -> largestcluster,
+	  stats -> meanclustersize,
+	  stats -> joinsame,
+	  stats -> moran);
+  for (r = 0; r < RADIAL_MAX; ++r)
+    fprintf(fp, "\t%.3f", stats -> radial[r]);
+}
+
+/* union-find with path halving, roots are the lowest index */
+static int find(int * parent, int i)
+{
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+static void unite(int * parent, int i, int j)
+{
+  i = find(parent, i);
+  j = find(parent, j);
+  if (i < j)
+    parent[j] = i;
+  else if (j < i)
+    parent[i] = j;
+}
+
+/* clusters: label same-item regions in row bands, one band per thread,
+   then join the bands along their boundary rows and the torus seam */
+static void clusters(int * labels, int size, SpatialStats * stats)
+{
+  int n = size * size;
+  int * parent = (int *) malloc(n * sizeof(int));
+  int * sizes = (int *) calloc(n, sizeof(int));
+  assert(parent && sizes);
+
+  int nbands = 1;
+#ifdef _OPENMP
+  nbands = min(omp_get_max_threads(), size);
+#endif
+  int band;
+#pragma omp parallel for schedule(static)
+  for (band = 0; band < nbands; ++band) {
+    int x0 = (band * size) / nbands;
+    int x1 = ((band + 1) * size) / nbands;
+    int x, y;
+    for (x = x0; x < x1; ++x)
+      for (y = 0; y < size; ++y)
+	parent[x * size + y] = x * size + y;
+    for (x = x0; x < x1; ++x) {
+      for (y = 0; y < size; ++y) {
+	int i = x * size + y;
+	int right = x * size + (y + 1) % size;
+	if (labels[i] == labels[right])
+	  unite(parent, i, right);
+	if (x + 1 < x1 && labels[i] == labels[i + size])
+	  unite(parent, i, i + size);
+      }
+    }
+  }
+  for (band = 0; band < nbands; ++band) {
+    int x = ((band + 1) * size) / nbands - 1;
+    int y;
+    for (y = 0; y < size; ++y) {
+      int i = x * size + y;
+      int down = ((x + 1) % size) * size + y;
+      if (labels[i] == labels[down])
+	unite(parent, i, down);
+    }
+  }
+
+  int i;
+  for (i = 0; i < n; ++i)
+    sizes[find(parent, i)]++;
+  stats -> nclusters = 0;
+  stats -> largestcluster = 0;
+  double sumsq = 0.0;
+  for (i = 0; i < n; ++i) {
+    if (sizes[i]) {
+      stats -> nclusters++;
+      stats -> largestcluster = max(stats -> largestcluster, sizes[i]);
+      sumsq += (double) sizes[i] * sizes[i];
+    }
+  }
+  stats -> meanclustersize = sumsq / n;
+  free(parent);
+  free(sizes);
+}
+
+/* joins: like-label join fraction and Moran's I over right and down joins */
+static void joins(int * labels, float * values, int size, SpatialStats * stats)
+{
+  int n = size * size;
+  double mean = 0.0;
+  int i;
+#pragma omp parallel for reduction(+:mean) schedule(static)
+  for (i = 0; i < n; ++i)
+    mean += values[i];
+  mean /= n;
+
+  long same = 0;
+  double ssq = 0.0, cross = 0.0;
+#pragma omp parallel for reduction(+:same,ssq,cross) schedule(static)
+  for (i = 0; i < n; ++i) {
+    int x = i / size;
+    int y = i % size;
+    int right = x * size + (y + 1) % size;
+    int down = ((x + 1) % size) * size + y;
+    double z = values[i] - mean;
+    same += (labels[i] == labels[right]) + (labels[i] == labels[down]);
+    ssq += z * z;
+    cross += z * (values[right] - mean) + z * (values[down] - mean);
+  }
+  stats -> joinsame = (float) same / (2.0 * n);
+  // I = (N / W) sum_ij w_ij z_i z_j / sum z^2, with W = 4N and each join twice
+  stats -> moran = (ssq > 0.0) ? cross / (2.0 * ssq) : 0.0;
+}
+
+/* radial: same-label probability per distance shell minus the chance level,
+   one sweep over the grid per offset within RADIAL_MAX */
+static void radial(int * labels, int size, int nlabels, SpatialStats * stats)
+{
+  int n = size * size;
+  int * counts = (int *) calloc(nlabels, sizeof(int));
+  assert(counts);
+  int i;
+  for (i = 0; i < n; ++i)
+    counts[labels[i]]++;
+  double chance = 0.0;
+  for (i = 0; i < nlabels; ++i)
+    chance += ((double) counts[i] / n) * ((double) counts[i] / n);
+  free(counts);
+
+  long same[RADIAL_MAX] = {0};
+  long pairs[RADIAL_MAX] = {0};
+  int dx, dy;
+  for (dx = -RADIAL_MAX; dx <= RADIAL_MAX; ++dx) {
+    for (dy = -RADIAL_MAX; dy <= RADIAL_MAX; ++dy) {
+      int shell = (int) round(sqrt(dx * dx + dy * dy));
+      if (shell < 1 || shell > RADIAL_MAX)
+	continue;
+      int ox = ((dx % size) + size) % size;
+      int oy = ((dy % size) + size) % size;
+      long s = 0;
+      int x;
+#pragma omp parallel for reduction(+:s) schedule(static)
+      for (x = 0; x < size; ++x) {
+	int * row = labels + x * size;
+	int * other = labels + ((x + ox) % size) * size;
+	int y;
+	for (y = 0; y < size - oy; ++y)
+	  s += (row[y] == other[y + oy]);
+	for (y = size - oy; y < size; ++y)
+	  s += (row[y] == other[y + oy - size]);
+      }
+      same[shell - 1] += s;
+      pairs[shell - 1] += n;
+    }
+  }
+  int r;
+  for (r = 0; r < RADIAL_MAX; ++r)
+    stats -> radial[r] = (float) ((double) same[r] / pairs[r] - chance);
+}
@@ -0,0 +1,29 @@
+/*
+ * spatial.h
+ * in-run spatial statistics over a labelled torus grid
+ * maarten
+ */
+
+#ifndef SPATIAL_H_
+#define SPATIAL_H_
+
+#define RADIAL_MAX 4 /* number of radial correlation shells */
+
+typedef struct {
+  int nclusters;        /* connected same-label regions (4-neighbourhood) */
+  int largestcluster;
+  float meanclustersize; /* size-weighted mean: sum(s^2) / N */
+  float joinsame;       /* fraction of neighbour joins with equal labels */
+  float moran;          /* Moran's I of the values, rook weights */
+  float radial[RADIAL_MAX]; /* P(same label | distance r) - P(same label), r = 1.. */
+} SpatialStats;
+
+void spatialstats(int * labels,
+		  float * values,
+		  int size,
+		  int nlabels,
+		  SpatialStats * stats
+		  );
+void spatialstats_fprint(FILE *, SpatialStats *);
+
+#endif /* SPATIAL_H_ */
@@ -0,0 +1,154 @@
+/*
+ * stats.c
+ * two sample tests and t quantiles for the driver tools
+ * maarten
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stats.h"
+
+/* prototypes */
+static double betacf(double, double, double);
+static int cmp_double(const void *, const void *);
+
+/* stats_welch: two sided p-value of Welch's t-test */
+double stats_welch(double * a, double * b, int n)
+{
+  double ma = 0.0, mb = 0.0, va = 0.0, vb = 0.0;
+  int i;
+  for (i = 0; i < n; ++i) {
+    ma += a[i];
+    mb += b[i];
+  }
+  ma /= n;
+  mb /= n;
+  for (i = 0; i < n; ++i) {
+    va += (a[i] - ma) * (a[i] - ma);
+    vb += (b[i] - mb) * (b[i] - mb);
+  }
+  va /= n - 1;
+  vb /= n - 1;
+  double se = va / n + vb / n;
+  if (se == 0.0)
+    return (ma == mb) ? 1.0 : 0.0;
+  double t = (ma - mb) / sqrt(se);
+  double df = se * se / ((va / n) * (va / n) / (n - 1) + (vb / n) * (vb / n) / (n - 1));
+  return stats_betai(0.5 * df, 0.5, df / (df + t * t));
+}
+
+/* stats_ks2: asymptotic p-value of the two sample Kolmogorov-Smirnov test */
+double stats_ks2(double * a, double * b, int n)
+{
+  double * sa = (double *) malloc(n * sizeof(double));
+  double * sb = (double *) malloc(n * sizeof(double));
+  memcpy(sa, a, n * sizeof(double));
+  memcpy(sb, b, n * sizeof(double));
+  qsort(sa, n, sizeof(double), cmp_double);
+  qsort(sb, n, sizeof(double), cmp_double);
+  int i = 0, j = 0;
+  double d = 0.0;
+  while (i < n && j < n) {
+    double x = (sa[i] <= sb[j]) ? sa[i] : sb[j];
+    while (i < n && sa[i] <= x)
+      i++;
+    while (j < n && sb[j] <= x)
+      j++;
+    double diff = fabs((double) (i - j) / n);
+    if (diff > d)
+      d = diff;
+  }
+  free(sa);
+  free(sb);
+  double en = sqrt(n / 2.0);
+  double lambda = (en + 0.12 + 0.11 / en) * d;
+  if (lambda < 0.2)
+    return 1.0;
+  double sum = 0.0, sign = 1.0;
+  int k;
+  for (k = 1; k <= 100; ++k) {
+    double term = sign * 2.0 * exp(-2.0 * k * k * lambda * lambda);
+    sum += term;
+    if (fabs(term) < 1e-10)
+      break;
+    sign = -sign;
+  }
+  return (sum < 0.0) ? 0.0 : (sum > 1.0) ? 1.0 : sum;
+}
+
+/* stats_betai: regularized incomplete beta function I_x(a,b) */
+double stats_betai(double a, double b, double x)
+{
+  if (x <= 0.0)
+    return 0.0;
+  if (x >= 1.0)
+    return 1.0;
+  double bt = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1.0 - x));
+  if (x < (a + 1.0) / (a + b + 2.0))
+    return bt * betacf(a, b, x) / a;
+  return 1.0 - bt * betacf(b, a, 1.0 - x) / b;
+}
+
+/* stats_tquantile: two sided critical value of Student's t, the t with
+   P(|T| > t) = alpha at df degrees of freedom */
+double stats_tquantile(double alpha, double df)
+{
+  double lo = 0.0, hi = 1.0;
+  while (stats_betai(0.5 * df, 0.5, df / (df + hi * hi)) > alpha && hi < 1e6)
+    hi *= 2.0;
+  int i;
+  for (i = 0; i < 100; ++i) {
+    double mid = 0.5 * (lo + hi);
+    if (stats_betai(0.5 * df, 0.5, df / (df + mid * mid)) > alpha)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return 0.5 * (lo + hi);
+}
+
+/* betacf: continued fraction for stats_betai (modified Lentz) */
+static double betacf(double a, double b, double x)
+{
+  double tiny = 1e-30;
+  double qab = a + b, qap = a + 1.0, qam = a - 1.0;
+  double c = 1.0, d = 1.0 - qab * x / qap;
+  if (fabs(d) < tiny)
+    d = tiny;
+  d = 1.0 / d;
+  double h = d;
+  int m;
+  for (m = 1; m <= 200; ++m) {
+    int m2 = 2 * m;
+    double aa = m * (b - m) * x / ((qam + m2) * (a + m2));
+    d = 1.0 + aa * d;
+    if (fabs(d) < tiny)
+      d = tiny;
+    c = 1.0 + aa / c;
+    if (fabs(c) < tiny)
+      c = tiny;
+    d = 1.0 / d;
+    h *= d * c;
+    aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2));
+    d = 1.0 + aa * d;
+    if (fabs(d) < tiny)
+      d = tiny;
+    c = 1.0 + aa / c;
+    if (fabs(c) < tiny)
+      c = tiny;
+    d = 1.0 / d;
+    double del = d * c;
+    h *= del;
+    if (fabs(del - 1.0) < 1e-12)
+      break;
+  }
+  return h;
+}
+
+/* cmp_double: ascending doubles for qsort */
+static int cmp_double(const void * a, const void * b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
@@ -0,0 +1,15 @@
+/*
+ * stats.h
+ * two sample tests and t quantiles for the driver tools
+ * maarten
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+double stats_welch(double *, double *, int);
+double stats_ks2(double *, double *, int);
+double stats_betai(double, double, double);
+double stats_tquantile(double, double);
+
+#endif /* STATS_H_ */
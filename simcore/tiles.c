@@ -0,0 +1,127 @@
+/*
+ * tiles.c
+ * grids larger than memory: fixed-size tiles of rows in a memory-mapped
+ * file, see tiles.h
+ * maarten
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "tiles.h"
+
+/* prototypes */
+static void tilerange(TileFile *, int, int, size_t *, size_t *);
+
+/* tiles_open: map a zeroed file of bytes bytes in tiles of tilebytes. The
+   file is unlinked once mapped, so its blocks go with the process; put it
+   on a disk with room for the grid, not on a tmpfs */
+TileFile * tiles_open(const char * path, size_t bytes, size_t tilebytes)
+{
+  TileFile * tf = (TileFile *) calloc(1, sizeof(TileFile));
+  if (!tf) {
+    fprintf(stderr,"Memory allocation failure: TileFile.\n");
+    exit(EXIT_FAILURE);
+  }
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0 || ftruncate(fd, bytes)) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  tf -> base = (char *) mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (tf -> base == MAP_FAILED) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  unlink(path);
+  close(fd);
+  tf -> bytes = bytes;
+  tf -> tilebytes = (tilebytes > 0 && tilebytes < bytes) ? tilebytes : bytes;
+  tf -> ntiles = (bytes + tf -> tilebytes - 1) / tf -> tilebytes;
+  return tf;
+}
+
+void tiles_close(TileFile * tf)
+{
+  if (!tf)
+    return;
+  munmap(tf -> base, tf -> bytes);
+  free(tf);
+}
+
+/* tiles_rows: rows per tile for rows of rowbytes, at least one */
+int tiles_rows(int nrows, size_t rowbytes)
+{
+  size_t rows = TILE_BYTES / rowbytes;
+  if (rows < 1)
+    rows = 1;
+  return (rows < (size_t) nrows) ? (int) rows : nrows;
+}
+
+/* tiles_prefetch: start reading tile t in the background */
+void tiles_prefetch(TileFile * tf, int t)
+{
+  size_t from, to;
+  tilerange(tf, t, 0, &from, &to);
+  if (to > from) {
+    madvise(tf -> base + from, to - from, MADV_WILLNEED);
+    tf -> prefetched++;
+  }
+}
+
+/* tiles_release: drop the pages of tile t from memory; on a shared file
+   mapping dirty pages go back to the page cache and are written out, only
+   pages that lie entirely within the tile are dropped */
+void tiles_release(TileFile * tf, int t)
+{
+  size_t from, to;
+  tilerange(tf, t, 1, &from, &to);
+  if (to > from) {
+    madvise(tf -> base + from, to - from, MADV_DONTNEED);
+    tf -> released++;
+  }
+}
+
+/* tiles_window: before working on tile t of an increasing sweep with a
+   halo of halo tiles: request the tile entering the halo and release the
+   one that left it. Tiles 0..halo-1 and the last halo tiles stay, they
+   are each other's halo across the wrap of the torus */
+void tiles_window(TileFile * tf, int t, int halo)
+{
+  if (!tf)
+    return;
+  int ntiles = tf -> ntiles;
+  if (t == 0) {
+    int k;
+    for (k = 0; k <= halo && k < ntiles; ++k)
+      tiles_prefetch(tf, k);
+    for (k = ntiles - halo; k < ntiles; ++k)
+      if (k > halo)
+	tiles_prefetch(tf, k);
+  }
+  if (t + halo + 1 < ntiles)
+    tiles_prefetch(tf, t + halo + 1);
+  if (t - halo - 1 >= halo)
+    tiles_release(tf, t - halo - 1);
+}
+
+/* tilerange: page-aligned byte range of tile t, rounded outwards or,
+   with inner set, inwards */
+static void tilerange(TileFile * tf, int t, int inner, size_t * from, size_t * to)
+{
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t start = (size_t) t * tf -> tilebytes;
+  size_t end = start + tf -> tilebytes;
+  if (end > tf -> bytes)
+    end = tf -> bytes;
+  if (inner) {
+    start = (start + page - 1) / page * page;
+    end = (end == tf -> bytes) ? end : end / page * page;
+  } else {
+    start = start / page * page;
+  }
+  *from = start;
+  *to = (end > start) ? end : start;
+}
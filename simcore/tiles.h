@@ -0,0 +1,39 @@
+/*
+ * tiles.h
+ * grids larger than memory: fixed-size tiles of rows in a memory-mapped
+ * file, swept in order with read-ahead of the tiles to come and release
+ * of the tiles done with
+ * maarten
+ *
+ * A tile is a band of whole rows, so the mapping keeps the flat row-major
+ * agent index of an in-memory grid. A sweep over the tiles with a halo of
+ * h tiles needs tiles t-h..t+h resident while tile t is worked on; tile
+ * t+h+1 is requested ahead so its I/O overlaps the work on tile t.
+ */
+
+#ifndef TILES_H_
+#define TILES_H_
+
+#include <stddef.h>
+
+#ifndef TILE_BYTES
+#define TILE_BYTES (16 * 1024 * 1024) /* target tile size */
+#endif
+
+typedef struct {
+  char * base;
+  size_t bytes;
+  size_t tilebytes; /* last tile may be shorter */
+  int ntiles;
+  long prefetched;  /* tiles requested ahead */
+  long released;
+} TileFile;
+
+TileFile * tiles_open(const char *, size_t, size_t);
+void tiles_close(TileFile *);
+int tiles_rows(int, size_t);
+void tiles_prefetch(TileFile *, int);
+void tiles_release(TileFile *, int);
+void tiles_window(TileFile *, int, int);
+
+#endif /* TILES_H_ */
@@ -0,0 +1,60 @@
+/*
+ * torus.c
+ * shared step loop and report helpers, see torus.h
+ * maarten
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "torus.h"
+
+/* torus_advance: step and report up to laststep */
+void torus_advance(TorusModel * model, int laststep)
+{
+  while (*model -> currentstep < laststep) {
+    struct timespec t0, t1;
+    (*model -> currentstep)++;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    model -> step(model -> sim);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    model -> numastat -> seconds += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    model -> report(model -> sim);
+  }
+}
+
+/* torus_openreport: open a report file or give up */
+FILE * torus_openreport(const char * name, const char * mode)
+{
+  FILE * fp = fopen(name, mode);
+  if (!fp) {
+    perror(name);
+    exit(EXIT_FAILURE);
+  }
+  return fp;
+}
+
+/* torus_maxidx_int: index of the first largest element */
+int torus_maxidx_int(const int * arr, int n)
+{
+  int maxidx = 0;
+  int i;
+  for (i = 1; i < n; ++i) {
+    if (arr[i] > arr[maxidx])
+      maxidx = i;
+  }
+  return maxidx;
+}
+
+/* torus_maxidx_float: idem for floats */
+int torus_maxidx_float(const float * arr, int n)
+{
+  int maxidx = 0;
+  int i;
+  for (i = 1; i < n; ++i) {
+    if (arr[i] > arr[maxidx])
+      maxidx = i;
+  }
+  return maxidx;
+}
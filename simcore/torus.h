@@ -0,0 +1,48 @@
+/*
+ * torus.h
+ * what the models share: the geometry of the toroidal grid, report
+ * files and the step loop a model plugs its update and report into
+ * maarten
+ *
+ * Agents live on a size by size torus in row-major order, agent i at
+ * row i / size, column i % size. A model's step updates the whole grid
+ * and its report writes the state after it; torus_advance() runs them,
+ * so both models share one loop and one timing.
+ */
+
+#ifndef TORUS_H_
+#define TORUS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "numa.h"
+
+typedef struct {
+  void * sim;
+  void (*step)(void *);   /* one update of the whole grid */
+  void (*report)(void *); /* the grid after a step */
+  int * currentstep;      /* advanced before each step */
+  NumaStat * numastat;    /* step seconds add up here */
+} TorusModel;
+
+void torus_advance(TorusModel *, int);
+FILE * torus_openreport(const char *, const char *);
+int torus_maxidx_int(const int *, int);
+int torus_maxidx_float(const float *, int);
+
+/* torus_distance: euclidean distance between flat indices, in the
+   inner loops of both models */
+static inline float torus_distance(int pos1, int pos2, int size)
+{
+  int xdiff = abs(pos1 / size - pos2 / size);
+  int ydiff = abs(pos1 % size - pos2 % size);
+  if (size - xdiff < xdiff)
+    xdiff = size - xdiff;
+  if (size - ydiff < ydiff)
+    ydiff = size - ydiff;
+  return sqrt(xdiff*xdiff + ydiff*ydiff);
+}
+
+#endif /* TORUS_H_ */
@@ -0,0 +1,117 @@
+/*
+ * tune.c
+ * startup autotuning: timing and the tuning cache, see tune.h
+ * maarten
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "tune.h"
+
+#define TUNE_LINE_SIZE 512
+
+/* prototypes */
+static int cachepath(char *, size_t);
+
+/* tune_clock: monotonic seconds */
+double tune_clock(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* tune_key: host, threads and cache size in front of the problem shape;
+   tabs and newlines in shape become spaces */
+void tune_key(char * key, size_t len, const char * shape)
+{
+  char host[64] = "unknown";
+  gethostname(host, sizeof(host) - 1);
+  int threads = 1;
+#ifdef _OPENMP
+  threads = omp_get_max_threads();
+#endif
+  long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  snprintf(key, len, "%s/%dt/%ldk/%s", host, threads, (l2 > 0) ? l2 / 1024 : 0, shape);
+  char * c;
+  for (c = key; *c; ++c)
+    if (*c == '\t' || *c == '\n')
+      *c = ' ';
+}
+
+/* tune_lookup: the cached parameters of key, 1 if there are any */
+int tune_lookup(const char * key, int * params, int nparams)
+{
+  char path[TUNE_LINE_SIZE];
+  if (!cachepath(path, sizeof(path)))
+    return 0;
+  FILE * fp = fopen(path, "r");
+  if (!fp)
+    return 0;
+  flock(fileno(fp), LOCK_SH);
+  char line[TUNE_LINE_SIZE];
+  size_t keylen = strlen(key);
+  int found = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    if (strncmp(line, key, keylen) || line[keylen] != '\t')
+      continue;
+    char * s = strchr(line + keylen + 1, '\t');
+    int p;
+    for (p = 0; s && p < nparams; ++p) {
+      char * end;
+      params[p] = strtol(s + 1, &end, 10);
+      if (end == s + 1)
+	break;
+      s = end;
+    }
+    found = (p == nparams);
+  }
+  flock(fileno(fp), LOCK_UN);
+  fclose(fp);
+  return found;
+}
+
+/* tune_store: append the choice for key; concurrent runs of a sweep
+   append whole lines under an exclusive lock */
+void tune_store(const char * key, double seconds, int * params, int nparams)
+{
+  char path[TUNE_LINE_SIZE];
+  if (!cachepath(path, sizeof(path)))
+    return;
+  FILE * fp = fopen(path, "a");
+  if (!fp)
+    return;
+  flock(fileno(fp), LOCK_EX);
+  fprintf(fp, "%s\t%.6g", key, seconds);
+  int p;
+  for (p = 0; p < nparams; ++p)
+    fprintf(fp, "\t%d", params[p]);
+  fprintf(fp, "\n");
+  fflush(fp);
+  flock(fileno(fp), LOCK_UN);
+  fclose(fp);
+}
+
+/* cachepath: 0 if caching is off */
+static int cachepath(char * path, size_t len)
+{
+  const char * env = getenv("SOCTUNE_CACHE");
+  if (env) {
+    snprintf(path, len, "%s", env);
+    return *env != '\0';
+  }
+  const char * home = getenv("HOME");
+  if (!home)
+    return 0;
+  snprintf(path, len, "%s/.soctune", home);
+  return 1;
+}
@@ -0,0 +1,27 @@
+/*
+ * tune.h
+ * startup autotuning: a wall clock for timing candidate kernels and a
+ * cache of the choices, keyed by machine and problem shape, so the runs
+ * of a sweep tune once
+ * maarten
+ *
+ * The cache is a text file, one choice per line: key, seconds per step,
+ * parameters, tab separated; the last line of a key counts. It lives in
+ * $SOCTUNE_CACHE, else ~/.soctune; SOCTUNE_CACHE set to the empty string
+ * turns caching off.
+ */
+
+#ifndef TUNE_H_
+#define TUNE_H_
+
+#include <stddef.h>
+
+#define TUNE_KEY_SIZE 256
+#define TUNE_MAXPARAMS 8
+
+double tune_clock(void);
+void tune_key(char *, size_t, const char *);
+int tune_lookup(const char *, int *, int);
+void tune_store(const char *, double, int *, int);
+
+#endif /* TUNE_H_ */
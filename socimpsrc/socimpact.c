@@ -10,7 +10,7 @@
 
 int main(int argc, char * argv[])
 {
-  if (argc != 14) {
+  if (argc < 14 || argc == 16) {
     printf("\nsocimpact: Social Impact simulation.\n");
     printf("\t1. Report path\n");
     printf("\t2. Size (grid is size by size)\n");
@@ -24,7 +24,10 @@ int main(int argc, char * argv[])
     printf("\t10. Learning mode:\n\t\t0: maximize-maximize\n\t\t1. maximize-sample\n\t\t2. sample\n");
     printf("\t11. Bias [0.0-2.0]\n");
     printf("\t12. Mutation rate [0.0-1.0]\n");
-    printf("\t13. Norm impact [1.0-2.0]\n\n");
+    printf("\t13. Norm impact [1.0-2.0]\n");
+    printf("\t14. Impact samples per young agent (optional, 0: exact sums)\n");
+    printf("\t15. Burn-in steps (optional, branch mode)\n");
+    printf("\t16. Branch variants \"bias,murate\", one argument per branch\n\n");
   } else {
     char * path = argv[1];
     int size = atoi(argv[2]);
@@ -83,6 +86,24 @@ int main(int argc, char * argv[])
     }
     printf("\tStatus distribution:\t%s\n",stat);
     printf("\nReporting to: %s\n\n",path);
+    int nsamples = (argc > 14) ? atoi(argv[14]) : 0;
+    if (nsamples > 0)
+      printf("Impacts sampled from %d sources per young agent\n\n",nsamples);
+    int burnin = 0, nbranches = 0;
+    float * biases = NULL, * murates = NULL;
+    if (argc > 15) {
+      burnin = atoi(argv[15]);
+      nbranches = argc - 16;
+      biases = (float *) malloc(nbranches * sizeof(float));
+      murates = (float *) malloc(nbranches * sizeof(float));
+      int b;
+      for (b = 0; b < nbranches; ++b)
+	if (sscanf(argv[16 + b], "%f,%f", &biases[b], &murates[b]) != 2) {
+	  printf("Illegal branch variant: %s\n",argv[16 + b]);
+	  exit(EXIT_FAILURE);
+	}
+      printf("Burn-in of %d steps, %d branches\n\n",burnin,nbranches);
+    }
     Simulation * sim = init_sim(size,
 				nsteps,
 				seed,
@@ -96,7 +117,13 @@ int main(int argc, char * argv[])
 				murate,
 				normimpact,
 				path);
-    run(sim);
+    set_samples(sim, nsamples);
+    if (nbranches) {
+      run_branches(sim, burnin, nbranches, biases, murates, path);
+      free(biases);
+      free(murates);
+    } else
+      run(sim);
     printf("Simulation done.\n");
   }
   return 0;
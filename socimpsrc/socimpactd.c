@@ -0,0 +1,407 @@
+/*
+ * socimpactd.c
+ * social impact simulations as a local service: jobs come in over a
+ * UNIX socket, run one after the other in one warm process, highest
+ * priority first, and their short report streams back as they run
+ * maarten
+ *
+ * A job is one line of tab-separated fields: a priority, then the
+ * arguments of socimpact up to the impact samples. The service answers
+ * "queued <n>" with the number of jobs already waiting, then one report line
+ * per step, then "done <seconds>" or "error <reason>"; the report files
+ * are written as by socimpact. Buffers freed by a job are kept for the
+ * next of the same size (numa_keep()), and the OpenMP threads and their
+ * pinning stay up between jobs. New jobs are taken in between the steps
+ * of the one that runs; a job does not preempt another. Connections are
+ * non-blocking: job lines are read as they come, and output waits in a
+ * buffer per client, which a client that stops reading loses once it
+ * holds JOB_MAXOUT bytes; its job runs on.
+ */
+
+#define _GNU_SOURCE /* memmem */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "socimpactfuncs.h"
+#include "numa.h"
+
+#ifndef max
+#define max(a , b) ( ((a) > (b)) ? (a) : (b) )
+#endif
+
+#define JOB_MAXARGS 16
+#define JOB_LINE 4096
+#define JOB_READWAIT 10000 /* ms a client gets to send its job line */
+#define JOB_MAXOUT (1 << 20) /* bytes of output held for a slow client */
+
+/* a connection, from its job line to the end of its output */
+#define JOB_READING 0
+#define JOB_QUEUED 1
+#define JOB_RUNNING 2
+#define JOB_DONE 3 /* output left to send */
+
+typedef struct {
+  int fd; /* -1: client gone or dropped */
+  int state;
+  double since; /* JOB_READING: when it connected */
+  int priority;
+  long seq;
+  int nargs;
+  char * args[JOB_MAXARGS]; /* point into line */
+  char line[JOB_LINE];
+  int len; /* of line so far */
+  char * out;
+  size_t outlen;
+  size_t outcap;
+} Job;
+
+static int listenfd = -1;
+static Job ** jobs = NULL; /* every connection in any state */
+static int njobs = 0;
+static long nextseq = 0;
+
+static int serve(const char *);
+static int submit(const char *, int, char **);
+static void service(int);
+static void accepted(int);
+static void readjob(Job *);
+static void flush(Job *);
+static void drop(Job *);
+static Job * nextjob(void);
+static void runjob(Job *);
+static char * checkjob(Job *);
+static void sendf(Job *, const char *, ...);
+static double now(void);
+static int opensocket(const char *, struct sockaddr_un *);
+
+int main(int argc, char * argv[])
+{
+  if (argc == 2)
+    return serve(argv[1]);
+  if (argc >= 4)
+    return submit(argv[1], argc - 2, argv + 2);
+  printf("\nsocimpactd: social impact simulations as a local service.\n");
+  printf("\t1. Socket path, alone: serve jobs on it\n");
+  printf("\t2. Priority, higher first: submit a job and print its reports\n");
+  printf("\t3. The arguments of socimpact, up to the impact samples\n\n");
+  return 0;
+}
+
+/* serve: the service loop, jobs waiting or not */
+static int serve(const char * path)
+{
+  struct sockaddr_un addr;
+  listenfd = opensocket(path, &addr);
+  unlink(path);
+  if (bind(listenfd, (struct sockaddr *) &addr, sizeof(addr)) || listen(listenfd, 64)
+      || fcntl(listenfd, F_SETFL, O_NONBLOCK)) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  numa_keep(1);
+  printf("socimpactd: serving on %s\n",path);
+  fflush(stdout);
+  while (1) {
+    Job * job = nextjob();
+    if (job)
+      runjob(job);
+    else
+      service(-1);
+  }
+  return 0;
+}
+
+/* submit: send one job, print what comes back */
+static int submit(const char * path, int nargs, char ** args)
+{
+  struct sockaddr_un addr;
+  int fd = opensocket(path, &addr);
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  char line[JOB_LINE];
+  int len = 0, a;
+  for (a = 0; a < nargs; ++a)
+    len += snprintf(line + len, JOB_LINE - len, "%s%s", a ? "\t" : "", args[a]);
+  if (len >= JOB_LINE - 1) {
+    fprintf(stderr,"Job line too long\n");
+    exit(EXIT_FAILURE);
+  }
+  line[len++] = '\n';
+  if (write(fd, line, len) != len) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  char buf[JOB_LINE];
+  ssize_t got;
+  int failed = 0;
+  while ((got = read(fd, buf, sizeof(buf))) > 0) {
+    fwrite(buf, 1, got, stdout);
+    failed |= got >= 6 && memmem(buf, got, "error ", 6) != NULL;
+  }
+  close(fd);
+  return failed ? EXIT_FAILURE : 0;
+}
+
+/* service: accept, read job lines and send output for up to timeout ms,
+   -1: until something happens or a job line is due */
+static void service(int timeout)
+{
+  int k;
+  // forget connections with nothing left to do
+  for (k = 0; k < njobs; ++k) {
+    Job * job = jobs[k];
+    if ((job -> state == JOB_READING || job -> state == JOB_DONE)
+	&& (job -> fd < 0 || (job -> state == JOB_DONE && !job -> outlen))) {
+      drop(job);
+      free(job -> out);
+      free(job);
+      jobs[k--] = jobs[--njobs];
+    }
+  }
+  struct pollfd pfd[njobs + 1];
+  pfd[0].fd = listenfd;
+  pfd[0].events = POLLIN;
+  double t = now();
+  for (k = 0; k < njobs; ++k) {
+    Job * job = jobs[k];
+    pfd[k + 1].fd = job -> fd;
+    pfd[k + 1].events = ((job -> state == JOB_READING) ? POLLIN : 0) | (job -> outlen ? POLLOUT : 0);
+    if (job -> state == JOB_READING) {
+      int left = (int) ((job -> since - t) * 1000.0) + JOB_READWAIT + 1;
+      if (timeout < 0 || left < timeout)
+	timeout = max(0, left);
+    }
+  }
+  int n = njobs;
+  if (poll(pfd, n + 1, timeout) < 0)
+    return;
+  // new connections go to the end, past the ones polled
+  for (k = 0; k < n; ++k) {
+    Job * job = jobs[k];
+    if (job -> fd < 0)
+      continue;
+    if (pfd[k + 1].revents & POLLIN)
+      readjob(job);
+    else if (job -> state == JOB_READING && now() - job -> since > JOB_READWAIT / 1000.0)
+      drop(job);
+    else if (pfd[k + 1].revents & (POLLERR | POLLHUP | POLLNVAL))
+      drop(job);
+    if (job -> fd >= 0 && (pfd[k + 1].revents & POLLOUT))
+      flush(job);
+  }
+  if (pfd[0].revents & POLLIN) {
+    int fd;
+    while ((fd = accept(listenfd, NULL, NULL)) >= 0)
+      accepted(fd);
+  }
+}
+
+/* accepted: a new connection, waiting for its job line */
+static void accepted(int fd)
+{
+  Job * job = (Job *) calloc(1, sizeof(Job));
+  if (!job || fcntl(fd, F_SETFL, O_NONBLOCK)) {
+    free(job);
+    close(fd);
+    return;
+  }
+  job -> fd = fd;
+  job -> state = JOB_READING;
+  job -> since = now();
+  jobs = (Job **) realloc(jobs, (njobs + 1) * sizeof(Job *));
+  jobs[njobs++] = job;
+}
+
+/* readjob: what the client sent so far; a whole line is split in place
+   and queued, or answered with an error */
+static void readjob(Job * job)
+{
+  ssize_t got = read(job -> fd, job -> line + job -> len, JOB_LINE - 1 - job -> len);
+  if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return;
+  if (got <= 0) {
+    drop(job);
+    return;
+  }
+  job -> len += got;
+  char * eol = memchr(job -> line, '\n', job -> len);
+  if (!eol && job -> len < JOB_LINE - 1)
+    return;
+  job -> line[job -> len] = '\0';
+  job -> line[strcspn(job -> line, "\r\n")] = '\0';
+  char * save, * tok;
+  for (tok = strtok_r(job -> line, "\t", &save); tok && job -> nargs < JOB_MAXARGS; tok = strtok_r(NULL, "\t", &save))
+    job -> args[job -> nargs++] = tok;
+  char * reason = eol ? checkjob(job) : "job line too long";
+  if (reason) {
+    sendf(job, "error %s\n", reason);
+    job -> state = JOB_DONE;
+    return;
+  }
+  int k, waiting = 0;
+  for (k = 0; k < njobs; ++k)
+    waiting += jobs[k] -> state == JOB_QUEUED;
+  job -> seq = nextseq++;
+  job -> state = JOB_QUEUED;
+  sendf(job, "queued %d\n", waiting);
+}
+
+/* checkjob: why the job cannot run, NULL if it can; init_sim() itself
+   would take the service down on a bad report path */
+static char * checkjob(Job * job)
+{
+  if (job -> nargs != 14 && job -> nargs != 15)
+    return "need a priority and the 13 or 14 arguments of socimpact";
+  job -> priority = atoi(job -> args[0]);
+  char ** a = job -> args + 1;
+  if (atoi(a[1]) < 1 || atoi(a[2]) < 0 || atoi(a[4]) < 1 || atoi(a[6]) < 2
+      || atoi(a[8]) < 0 || atoi(a[8]) > 2)
+    return "illegal size, steps, maximum age, items or status distribution";
+  char dir[JOB_LINE];
+  char * slash = strrchr(a[0], '/');
+  if (slash)
+    snprintf(dir, sizeof(dir), "%.*s", (int) (slash - a[0]) + 1, a[0]);
+  else
+    strcpy(dir, ".");
+  if (access(dir, W_OK))
+    return "report path not writable";
+  return NULL;
+}
+
+/* nextjob: highest priority, first come among equals */
+static Job * nextjob(void)
+{
+  Job * best = NULL;
+  int k;
+  for (k = 0; k < njobs; ++k) {
+    Job * job = jobs[k];
+    if (job -> state == JOB_QUEUED
+	&& (!best || job -> priority > best -> priority
+	    || (job -> priority == best -> priority && job -> seq < best -> seq)))
+      best = job;
+  }
+  return best;
+}
+
+/* runjob: run it step by step, taking new jobs in between */
+static void runjob(Job * job)
+{
+  job -> state = JOB_RUNNING;
+  char ** a = job -> args + 1;
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  Simulation * sim = init_sim(atoi(a[1]), atoi(a[2]), atoi(a[3]), atoi(a[4]), atoi(a[5]),
+			      atoi(a[6]), atoi(a[7]), atoi(a[8]), atoi(a[9]),
+			      atof(a[10]), atof(a[11]), atof(a[12]), a[0]);
+  set_samples(sim, (job -> nargs > 14) ? atoi(a[13]) : 0);
+  set_series(sim);
+  run_begin(sim);
+  int i;
+  do {
+    int row = sim -> currentstep;
+    char line[JOB_LINE];
+    int len = snprintf(line, sizeof(line), "%d\t%d\t%.3f", row,
+		       sim -> seriesmostfrequent[row], sim -> serieshomog[row]);
+    for (i = 0; i < sim -> nitems && len < JOB_LINE - 16; ++i)
+      len += sprintf(line + len, "\t%d", sim -> seriesitems[row * sim -> nitems + i]);
+    sendf(job, "%s\n", line);
+    service(0);
+  } while (run_steps(sim, 1));
+  run_end(sim);
+  free_sim(sim);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  sendf(job, "done %.3f\n", (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+  job -> state = JOB_DONE;
+}
+
+/* sendf: queue output for the job's client and send what it takes now;
+   a client JOB_MAXOUT bytes behind is dropped */
+static void sendf(Job * job, const char * fmt, ...)
+{
+  if (job -> fd < 0)
+    return;
+  char buf[JOB_LINE];
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len > (int) sizeof(buf) - 1)
+    len = sizeof(buf) - 1;
+  if (job -> outlen + len > JOB_MAXOUT) {
+    drop(job);
+    return;
+  }
+  if (job -> outlen + len > job -> outcap) {
+    job -> outcap = max(2 * job -> outcap, job -> outlen + len);
+    job -> out = (char *) realloc(job -> out, job -> outcap);
+    assert(job -> out);
+  }
+  memcpy(job -> out + job -> outlen, buf, len);
+  job -> outlen += len;
+  flush(job);
+}
+
+/* flush: send what the socket takes without blocking */
+static void flush(Job * job)
+{
+  size_t sent = 0;
+  while (sent < job -> outlen) {
+    ssize_t n = write(job -> fd, job -> out + sent, job -> outlen - sent);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+	drop(job);
+      break;
+    }
+    sent += n;
+  }
+  if (job -> fd < 0)
+    return;
+  memmove(job -> out, job -> out + sent, job -> outlen - sent);
+  job -> outlen -= sent;
+}
+
+/* drop: close the client, its job runs on */
+static void drop(Job * job)
+{
+  if (job -> fd >= 0)
+    close(job -> fd);
+  job -> fd = -1;
+  job -> outlen = 0;
+}
+
+static double now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int opensocket(const char * path, struct sockaddr_un * addr)
+{
+  memset(addr, 0, sizeof(*addr));
+  addr -> sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr -> sun_path)) {
+    fprintf(stderr,"Socket path too long: %s\n",path);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(addr -> sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
@@ -2,8 +2,21 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "socimpactfuncs.h"
+#include "spatial.h"
+#include "numa.h"
+#include "tune.h"
+#include "torus.h"
+#include "simd.h"
+#include "snapshot.h"
+#include "metrics.h"
 
 #ifndef max
 #define max(a , b) ( ((a) > (b)) ? (a) : (b) )
@@ -25,23 +38,119 @@
 
 #define LONGREPORT 0
 
+#ifndef EVENTREPORT
+#define EVENTREPORT 0 /* binary change log, see simcore/eventlog.h */
+#endif
+
+#ifndef SPATIALREPORT
+#define SPATIALREPORT 0 /* append cluster, join count and radial columns */
+#endif
+
 #define NAME_BUF_SIZE 300
 #define HYPER_THRESH 0.025
 #define EPSILON 0.000001
+#ifndef REFERENCE
+#define REFERENCE 0 /* frozen reference engine: serial dense path, see simcore/socdiff */
+#endif
+
+#ifndef LARGEVOCAB
+#define LARGEVOCAB 64 /* nitems from which the sparse item path is used */
+#endif
+#define SPARSE(nitems) ( !REFERENCE && (nitems) >= LARGEVOCAB )
+#define BRANCH_STRIDE 100003 /* seed offset between warm-start branches */
+#define IMPACT_CHUNK 1024 /* young agents collecting impacts in parallel */
+#define ISCHECK 100 /* sampled impacts: exact comparison every so many steps, 0: never */
+#ifndef AUTOTUNE
+#define AUTOTUNE 0 /* time the item paths at startup, see autotune() */
+#endif
+#ifndef SIMDIMPACTS
+#define SIMDIMPACTS 0 /* exact impacts in 16 lanes for up to SIMD_MAXLABELS items, see collectimpacts_simd() */
+#endif
+#ifndef FIXEDIMPACTS
+#define FIXEDIMPACTS 0 /* exact impacts summed in 64-bit fixed point, see collectimpacts_fixed() */
+#endif
+#define FIXED_MAXSHIFT 31 /* fraction bits of the kernel, 1 / 1^2 still fits 32 bits */
+#ifndef QUADTREE
+#define QUADTREE 0.0 /* opening ratio of the quadtree impacts, 0: exact sums, see collectimpacts_qt() */
+#endif
+#define QT_MAXITEMS 16 /* quadtree: widest vocabulary, nodes keep sums per item */
+#ifndef PARINIT
+#define PARINIT 0 /* fill the initial grid in parallel blocks, see init_grid() */
+#endif
+#ifndef INITSNAPSHOT
+#define INITSNAPSHOT 0 /* keep the initial grid in a mapped file for later runs */
+#endif
+#if INITSNAPSHOT && !PARINIT
+#error INITSNAPSHOT needs PARINIT, the random state after the grid is only known for block streams
+#endif
+#ifndef COARSEN
+#define COARSEN 0 /* block side of the coarse-to-fine mode, 0: off, see multigrid() */
+#endif
+#if COARSEN && EVENTREPORT
+#error COARSEN leaves the fine grid unstepped in coarse windows, the event log cannot follow
+#endif
+#define COARSE_WINDOW 10 /* steps classified at once */
+#define COARSE_HOMOG 0.6 /* a regime: the most frequent item at least this share */
+#define COARSE_CHECK 10 /* refine every so many windows regardless, 0: never */
+#define COARSE_STRIDE 104729 /* seed offset of the coarse run */
+#define INIT_BLOCK 65536 /* agents per random stream of the parallel fill */
+#define TUNE_SAMPLE 32 /* autotune: young agents timed per thread */
+#define TUNE_MAXDENSE 4096 /* autotune: widest vocabulary the dense path is tried with */
+
+/* decisions keyed with RNG_CRN, see rng_keyed() */
+#define CRN_STATUS 0
+#define CRN_AGE 1
+#define CRN_ITEM 2
+#define CRN_EXCEPTION 3
+#define CRN_SAMPLE 4
+
+/* mass of n zero items, 0 for an empty run even if the mass is not finite */
+#define ZEROMASS(n, m) ( ((n) > 0) ? (n) * (m) : 0.0 )
 
 /* prototypes */
 
 static void end_sim(Simulation *);
-static float rand01(void);
+static void advance(Simulation *, int);
+static void branch(Simulation *, int, float, float, char *);
+static FILE * branchcopy(FILE *, char *, char *, char *);
 static char * makefilename(Simulation *, char *, char *);
-static float distance(int, int, int);
 static void step(Simulation *);
 static void report(Simulation *);
 static void reportfinal(Simulation *);
+static void reportevents(Simulation *, int);
 static void collectimpacts(Simulation *, int, float *);
 static int sample(Simulation *, float *);
-static int maxidx_float(float *, int);
-static int maxidx_int(int *, int);
+static int learn(Simulation *, int, int, float *);
+static int agentage(Simulation *, int);
+static int learn_sparse(Simulation *, int, int);
+static int collectimpacts_sparse(Simulation *, int);
+static void top2_sparse(Simulation *, int, int *, int *);
+static int sample_sparse(Simulation *, int, int);
+static int cmp_int(const void *, const void *);
+static void collectimpacts_is(Simulation *, int, float *, float *);
+static void buildalias(Simulation *);
+static unsigned long long splitmix64(unsigned long long *);
+static void set_itempath(Simulation *, int);
+static void collectimpacts_simd(Simulation *, int, float *);
+static void sources_simd(Simulation *);
+static void collectimpacts_fixed(Simulation *, int, float *);
+static void fixed_build(Simulation *);
+static void qt_build(Simulation *);
+static void qt_split(Simulation *, int, int, int, int, int);
+static void qt_pull(Simulation *, int);
+static void qt_update(Simulation *, int, Agent *, Agent *);
+static double qt_kernel(Simulation *, int, int, int, int);
+static int qt_gap(int, int, int, int);
+static void collectimpacts_qt(Simulation *, int, float *);
+static void autotune(Simulation *);
+static Agent init_agent(Simulation *, Rng *, int);
+static void init_grid(Simulation *, char *);
+static void build_cohorts(Simulation *);
+static void coarse_build(Simulation *);
+static void coarse_restrict(Simulation *, Simulation *, int);
+static void coarse_record(Simulation *);
+static int regime(Simulation *, Agent *, int *, int);
+static void multigrid(Simulation *, int);
 
 Simulation * init_sim(int size,
 		      int nsteps,
@@ -64,6 +173,7 @@ Simulation * init_sim(int size,
   // init bookkeeping vars
   sim -> nsteps = nsteps;
   sim -> currentstep = 0;
+  sim -> ageclock = 0;
   sim -> nchanges = 0;
   sim -> tothomog = 0.0;
 
@@ -79,161 +189,823 @@ Simulation * init_sim(int size,
   sim -> murate = murate;
   sim -> normimpact = normimpact;
 
-  // init rand()
+  // init the random stream, see simcore/rng.h
   sim -> seed = seed;
-  srand(seed);
+  rng_seed(&sim -> rng, RNG_MODE, seed);
   
   // init file pointers
   char * shortreport = makefilename(sim, path, "short");
-  sim -> shortreportFP = fopen(shortreport,"w");
-  assert(sim -> shortreportFP);
+  sim -> shortreportFP = torus_openreport(shortreport, "w");
+  sim -> metrics = LIVEMETRICS ? metrics_open(MODEL_SOCIMPACT, nsteps, shortreport) : NULL;
   free(shortreport);
 
   if (LONGREPORT) {
     char * longreport = makefilename(sim, path, "long");
-    sim -> longreportFP = fopen(longreport, "w");
-    assert(sim -> longreportFP);
+    sim -> longreportFP = torus_openreport(longreport, "w");
     free(longreport);
   } else 
     sim -> longreportFP = NULL;
 
   char * finalreport = makefilename(sim, path, "final");
-  sim -> finalreportFP = fopen(finalreport, "w");
-  assert(sim -> finalreportFP);
+  sim -> finalreportFP = torus_openreport(finalreport, "w");
   free(finalreport);
 
-  // allocate grid
-  sim -> grid = (Agent *) malloc(size * size * sizeof(Agent));
-
-  // populate grid while keeping track of item numbers
+  // allocate and populate the grid
+  // pin the threads before their first touch places the buffers
+#ifdef _OPENMP
+  if (REFERENCE)
+    omp_set_num_threads(1);
+#endif
+  numa_pin(PINTHREADS);
+  numa_snapshot(&sim -> numastat);
+  init_grid(sim, path);
   int i;
+
+  // log the initial grid
+  if (EVENTREPORT) {
+    char * events = makefilename(sim, path, "events");
+    char types[2] = {'i', 'i'};
+    sim -> eventlog = eventlog_open(events, MODEL_SOCIMPACT, size, maxage, 1, 2, types);
+    free(events);
+    for (i = 0; i < size * size; ++i) {
+      unsigned int fields[2] = {sim -> grid[i].item, sim -> grid[i].status};
+      eventlog_agent(sim -> eventlog, agentage(sim, i), fields);
+    }
+  } else
+    sim -> eventlog = NULL;
+
+  build_cohorts(sim);
+
+  // impact buffers of the item path, autotune() may switch it
+  sim -> impactbuf = NULL;
+  sim -> itemcounts = NULL;
+  sim -> itemimpacts = NULL;
+  sim -> cummass = NULL;
+  sim -> touched = NULL;
+  set_itempath(sim, SPARSE(nitems));
+
+  // vectorized exact impacts: the distance table, sources per step
+  sim -> simd = -1;
+  sim -> srcitem = NULL;
+  sim -> srcstatus = NULL;
+  sim -> srccount = NULL;
+  sim -> dist2 = NULL;
+  sim -> fxstatus = NULL;
+  sim -> fxkernel = NULL;
+  sim -> fxshift = 0;
+  if (FIXEDIMPACTS && !REFERENCE && !sim -> sparse)
+    fixed_build(sim);
+  else if (SIMDIMPACTS && !REFERENCE && nitems <= SIMD_MAXLABELS) {
+    sim -> simd = simd_level();
+    sim -> srcitem = (int *) malloc(size * size * sizeof(int));
+    sim -> srcstatus = (float *) malloc(size * size * sizeof(float));
+    sim -> srccount = (int *) malloc(nitems * sizeof(int));
+    sim -> dist2 = (float *) numa_alloc(2 * size * size * sizeof(float));
+    assert(sim -> srcitem && sim -> srcstatus && sim -> srccount && sim -> dist2);
+    int dx, e;
+    for (dx = 0; dx < size; ++dx)
+      for (e = 0; e < 2 * size; ++e) {
+	float dist = torus_distance(0, dx * size + e % size, size);
+	sim -> dist2[dx * 2 * size + e] = dist * dist;
+      }
+  }
+
+  // quadtree impacts, dense item path only
+  sim -> qtnodes = NULL;
+  sim -> qtleaf = NULL;
+  sim -> qtcount = NULL;
+  sim -> qtstatus = NULL;
+  sim -> qtkernel = NULL;
+  sim -> qtvisits = 0;
+  if (QUADTREE > 0 && !REFERENCE && !sim -> sparse && nitems <= QT_MAXITEMS)
+    qt_build(sim);
+
+  // exact impacts unless set_samples() says otherwise
+  sim -> nsamples = 0;
+  sim -> aliasprob = NULL;
+  sim -> alias = NULL;
+  sim -> eligible = NULL;
+  sim -> sebuf = NULL;
+  sim -> aliasdirty = 1;
+  sim -> sesum = 0.0;
+  sim -> nestimates = 0;
+  sim -> nchecked = 0;
+  sim -> nagree = 0;
+
+  // the short report in memory, see set_series()
+  sim -> seriesitems = NULL;
+  sim -> seriesmostfrequent = NULL;
+  sim -> serieshomog = NULL;
+
+  // coarse-to-fine, when the blocks tile the grid into at least 2 by 2
+  sim -> coarse = NULL;
+  sim -> windowitems = NULL;
+  sim -> nwindows = 0;
+  sim -> nrefined = 0;
+  sim -> nfinesteps = 0;
+  sim -> nregimeagree = 0;
+  if (COARSEN > 1 && !REFERENCE && size >= 2 * COARSEN && size % max(COARSEN, 1) == 0)
+    coarse_build(sim);
+
+  return sim;
+}
+
+/* init_grid: populate the grid and find the most frequent item. With
+   PARINIT block b of INIT_BLOCK agents draws from the stream b jumps
+   ahead of the seed, so the grid is the same at any thread count, and the
+   run continues from the stream past the last block; with INITSNAPSHOT
+   the grid is mapped from, or generated into, a snapshot file next to the
+   reports */
+static void init_grid(Simulation * sim, char * path)
+{
+  int n = sim -> size * sim -> size;
+  int nitems = sim -> nitems;
   int itemsums[nitems];
+  int i;
   for (i = 0; i < nitems; ++i)
     itemsums[i] = 0;
+  sim -> snapshot = NULL;
+  if (!PARINIT) {
+    sim -> grid = (Agent *) numa_alloc(n * sizeof(Agent));
+    for (i = 0; i < n; ++i) {
+      sim -> grid[i] = init_agent(sim, &sim -> rng, i);
+      itemsums[sim -> grid[i].item]++;
+    }
+    sim -> mostfrequent = torus_maxidx_int(itemsums, nitems);
+    return;
+  }
 
-  for (i = 0; i < size * size; ++i) {
-    int xpos = i / size; // xposition on grid
-    // determine status
-    int status;
-    switch (statdistr) {
-    case 0: // all the same
-      status = 1;
-      break;
-    case 2: // hypers
-      if (rand01() < HYPER_THRESH) {
-	status = size * size * 25;
-	break;
-      }
-    case 1: // poisson approx
-      status = (int) pow(rand01() * (size - 1) + 1, 2.0);
+  int nblocks = (n + INIT_BLOCK - 1) / INIT_BLOCK;
+  Rng * streams = (Rng *) malloc(nblocks * sizeof(Rng));
+  assert(streams);
+  int b;
+  for (b = 0; b < nblocks; ++b)
+    rng_split(&sim -> rng, &streams[b]);
+  if (INITSNAPSHOT) {
+    char * name = (char *) malloc(NAME_BUF_SIZE);
+    sprintf(name, "%sinit_seed %d_size_%d_maxage_%d_aged_%d_nitems_%d_itemd_%d_statd_%d.grid",
+	    path, sim -> seed, sim -> size, sim -> maxage, sim -> agedistr, nitems,
+	    sim -> itemdistr, sim -> statdistr);
+    int key[12] = {MODEL_SOCIMPACT, sim -> seed, sim -> size, sim -> maxage, sim -> agedistr, nitems,
+		   sim -> itemdistr, sim -> statdistr, RNG_MODE, RNG_CRN, INIT_BLOCK, sizeof(Agent)};
+    sim -> snapshot = snapshot_open(name, key, 12, n * sizeof(Agent));
+    free(name);
+    sim -> grid = (Agent *) sim -> snapshot -> data;
+    if (!sim -> snapshot -> fresh) {
+      sim -> mostfrequent = sim -> snapshot -> aux[0];
+      free(streams);
+      return;
+    }
+  } else
+    sim -> grid = (Agent *) numa_alloc(n * sizeof(Agent));
+
+#pragma omp parallel for schedule(static) reduction(+:itemsums[:nitems])
+  for (b = 0; b < nblocks; ++b) {
+    int j;
+    for (j = b * INIT_BLOCK; j < min(n, (b + 1) * INIT_BLOCK); ++j) {
+      sim -> grid[j] = init_agent(sim, &streams[b], j);
+      itemsums[sim -> grid[j].item]++;
+    }
+  }
+  free(streams);
+  sim -> mostfrequent = torus_maxidx_int(itemsums, nitems);
+  if (sim -> snapshot) {
+    sim -> snapshot -> aux[0] = sim -> mostfrequent;
+    snapshot_seal(sim -> snapshot);
+    sim -> grid = (Agent *) sim -> snapshot -> data;
+  }
+}
+
+/* init_agent: initial status, age and item of agent i from rng */
+static Agent init_agent(Simulation * sim, Rng * rng, int i)
+{
+  int size = sim -> size;
+  int maxage = sim -> maxage;
+  int xpos = i / size; // xposition on grid
+  // determine status
+  int status;
+  rng_keyed(rng, sim -> seed, i, 0, CRN_STATUS);
+  switch (sim -> statdistr) {
+  case 0: // all the same
+    status = 1;
+    break;
+  case 2: // hypers
+    if (rng_float(rng) < HYPER_THRESH) {
+      status = size * size * 25;
       break;
-    default:
-      printf("Illegal value for statdistr: %d\n",statdistr);
-      exit(EXIT_FAILURE);
     }
-    // determine age
-    int age;
-    if (agedistr) { // cohort distr
-      if (xpos % maxage == xpos % (maxage * 2))
-	age = xpos % maxage + 1;
-      else
-	age = maxage - (xpos % maxage);
-    } else 
-      age = (int) round(rand01() * (maxage-1)) + 1;
-    // determine item
-    int item;
-    if (itemdistr)  // random items
-      item = (int) floor(rand01() * nitems);
+  case 1: // poisson approx
+    status = (int) pow(rng_float(rng) * (size - 1) + 1, 2.0);
+    break;
+  default:
+    printf("Illegal value for statdistr: %d\n",sim -> statdistr);
+    exit(EXIT_FAILURE);
+  }
+  // determine age
+  int age;
+  if (sim -> agedistr) { // cohort distr
+    if (xpos % maxage == xpos % (maxage * 2))
+      age = xpos % maxage + 1;
     else
-      item = 0; // default to lowest item
-    itemsums[item]++;
-    Agent a = {item,status,age};
-    sim -> grid[i] = a;
+      age = maxage - (xpos % maxage);
+  } else {
+    rng_keyed(rng, sim -> seed, i, 0, CRN_AGE);
+    age = (int) round(rng_float(rng) * (maxage-1)) + 1;
   }
-  // determine most frequent item
-  sim -> mostfrequent = maxidx_int(itemsums, nitems);
+  // determine item
+  int item;
+  rng_keyed(rng, sim -> seed, i, 0, CRN_ITEM);
+  if (sim -> itemdistr)  // random items
+    item = (int) floor(rng_float(rng) * sim -> nitems);
+  else
+    item = 0; // default to lowest item
+  Agent a = {item,status,age - 1}; // birth phase
+  return a;
+}
 
-  return sim;
+/* build_cohorts: agent indices by birth phase, in index order */
+static void build_cohorts(Simulation * sim)
+{
+  int n = sim -> size * sim -> size;
+  int maxage = sim -> maxage;
+  int i;
+  sim -> cohortstart = (int *) calloc(maxage + 1, sizeof(int));
+  sim -> cohorts = (int *) numa_alloc(n * sizeof(int));
+  sim -> pendidx = (int *) numa_alloc(n * sizeof(int));
+  sim -> pending = (Agent *) numa_alloc(n * sizeof(Agent));
+  assert(sim -> cohortstart);
+  for (i = 0; i < n; ++i)
+    sim -> cohortstart[sim -> grid[i].phase + 1]++;
+  for (i = 0; i < maxage; ++i)
+    sim -> cohortstart[i + 1] += sim -> cohortstart[i];
+  int fill[maxage];
+  for (i = 0; i < maxage; ++i)
+    fill[i] = sim -> cohortstart[i];
+  for (i = 0; i < n; ++i)
+    sim -> cohorts[fill[sim -> grid[i].phase]++] = i;
+}
+
+/*
+ * coarse-to-fine runs
+ *
+ * Next to the run sits a coarse run on a torus COARSEN times smaller a
+ * side: each coarse agent stands for a block, with the block's majority
+ * item, its mean status and the birth phase of its first agent. Poisson
+ * and hyper statuses scale with the square of the torus side, and the
+ * coarse run draws its rebirths at the coarse size, so the block means
+ * are divided by COARSEN^2 to put the agents not yet reborn on the same
+ * scale. Its 1 / d^2 kernel is the fine one up to a factor COARSEN^2 for
+ * every source alike, which leaves the choices as they are. The coarse
+ * run goes ahead a window of steps at a time. A window it ends in a
+ * regime -- the most frequent item at COARSE_HOMOG or more -- without a
+ * change of the most frequent item is reported from the coarse grid,
+ * spread back over the blocks. Any other
+ * window, and every COARSE_CHECK-th, is run again at full resolution
+ * from the grid at its start, the last coarse state spread over the
+ * blocks, after which the coarse run takes over the fine grid. The
+ * refined windows tell how often the coarse regime was the fine one.
+ */
+static void coarse_build(Simulation * sim)
+{
+  int f = COARSEN;
+  Simulation * c = (Simulation *) calloc(1, sizeof(Simulation));
+  assert(c);
+  c -> nsteps = sim -> nsteps;
+  c -> size = sim -> size / f;
+  c -> maxage = sim -> maxage;
+  c -> agedistr = sim -> agedistr;
+  c -> nitems = sim -> nitems;
+  c -> itemdistr = sim -> itemdistr;
+  c -> statdistr = sim -> statdistr;
+  c -> learningmode = sim -> learningmode;
+  c -> bias = sim -> bias;
+  c -> murate = sim -> murate;
+  c -> normimpact = sim -> normimpact;
+  c -> seed = sim -> seed + COARSE_STRIDE;
+  rng_seed(&c -> rng, RNG_MODE, c -> seed);
+  c -> simd = -1;
+  c -> aliasdirty = 1;
+  int nc = c -> size * c -> size;
+  c -> grid = (Agent *) numa_alloc(nc * sizeof(Agent));
+  c -> windowitems = (int *) malloc(COARSE_WINDOW * nc * sizeof(int));
+  assert(c -> windowitems);
+  coarse_restrict(sim, c, 1);
+  build_cohorts(c);
+  set_itempath(c, SPARSE(c -> nitems));
+  int items[c -> nitems];
+  regime(c, c -> grid, items, nc);
+  c -> mostfrequent = torus_maxidx_int(items, c -> nitems);
+  sim -> coarse = c;
+}
+
+/* coarse_restrict: the majority item of every block into the coarse
+   grid, the first agent's item on a tie; first also sets the statuses,
+   rescaled to the coarse size, and birth phases */
+static void coarse_restrict(Simulation * sim, Simulation * c, int first)
+{
+  int f = sim -> size / c -> size;
+  int bi, bj, k, l;
+#pragma omp parallel for private(bj, k, l) schedule(static)
+  for (bi = 0; bi < c -> size; ++bi)
+    for (bj = 0; bj < c -> size; ++bj) {
+      int block[f * f];
+      double status = 0.0;
+      for (k = 0; k < f; ++k)
+	for (l = 0; l < f; ++l) {
+	  Agent * a = &sim -> grid[(bi * f + k) * sim -> size + bj * f + l];
+	  block[k * f + l] = a -> item;
+	  status += a -> status;
+	}
+      int best = block[0], bestcount = 0;
+      for (k = 0; k < f * f; ++k) {
+	int count = 0;
+	for (l = 0; l < f * f; ++l)
+	  count += block[l] == block[k];
+	if (count > bestcount) {
+	  best = block[k];
+	  bestcount = count;
+	}
+      }
+      Agent * a = &c -> grid[bi * c -> size + bj];
+      a -> item = best;
+      if (first) {
+	a -> status = max(1, (int) round(status / (f * f) / (f * f)));
+	a -> phase = sim -> grid[bi * f * sim -> size + bj * f].phase;
+      }
+    }
+}
+
+/* coarse_record: the report of the coarse run, its items into the
+   window and its changes of the most frequent item */
+static void coarse_record(Simulation * c)
+{
+  int nc = c -> size * c -> size;
+  int * row = c -> windowitems + (c -> currentstep - c -> windowstart - 1) * nc;
+  int i;
+  for (i = 0; i < nc; ++i)
+    row[i] = c -> grid[i].item;
+  int items[c -> nitems];
+  regime(c, c -> grid, items, nc);
+  int mostfrequent = torus_maxidx_int(items, c -> nitems);
+  if (mostfrequent != c -> mostfrequent) {
+    c -> nchanges++;
+    c -> mostfrequent = mostfrequent;
+  }
+}
+
+/* regime: the most frequent item of the n agents of grid if it holds
+   COARSE_HOMOG of them, else -1; items gets the counts */
+static int regime(Simulation * sim, Agent * grid, int * items, int n)
+{
+  int i;
+  for (i = 0; i < sim -> nitems; ++i)
+    items[i] = 0;
+  for (i = 0; i < n; ++i)
+    items[grid[i].item]++;
+  int mostfrequent = torus_maxidx_int(items, sim -> nitems);
+  return (items[mostfrequent] >= COARSE_HOMOG * n) ? mostfrequent : -1;
+}
+
+/* multigrid: advance() of the coarse-to-fine mode, window by window */
+static void multigrid(Simulation * sim, int laststep)
+{
+  Simulation * c = sim -> coarse;
+  int f = sim -> size / c -> size;
+  int nc = c -> size * c -> size;
+  int items[sim -> nitems];
+  while (sim -> currentstep < laststep) {
+    int t0 = sim -> currentstep;
+    int t1 = min(laststep, (t0 / COARSE_WINDOW + 1) * COARSE_WINDOW);
+    int changes = c -> nchanges;
+    c -> windowstart = t0;
+    TorusModel coarse = {c,
+			 (void (*)(void *)) step,
+			 (void (*)(void *)) coarse_record,
+			 &c -> currentstep,
+			 &sim -> numastat};
+    torus_advance(&coarse, t1);
+    int coarseregime = regime(c, c -> grid, items, nc);
+    int check = COARSE_CHECK && sim -> nwindows % COARSE_CHECK == 0;
+    sim -> nwindows++;
+    if (coarseregime >= 0 && c -> nchanges == changes && !check) {
+      // the coarse steps stand for the fine ones
+      int t, i;
+      for (t = t0; t < t1; ++t) {
+	int * row = c -> windowitems + (t - t0) * nc;
+	for (i = 0; i < sim -> size * sim -> size; ++i) {
+	  Agent a = sim -> grid[i];
+	  a.item = row[(i / sim -> size / f) * c -> size + (i % sim -> size) / f];
+	  if (sim -> qtnodes)
+	    qt_update(sim, i, &sim -> grid[i], &a);
+	  sim -> grid[i] = a;
+	}
+	sim -> currentstep = t + 1;
+	sim -> ageclock = t + 1;
+	report(sim);
+      }
+      continue;
+    }
+    TorusModel fine = {sim,
+		       (void (*)(void *)) step,
+		       (void (*)(void *)) report,
+		       &sim -> currentstep,
+		       &sim -> numastat};
+    torus_advance(&fine, t1);
+    sim -> nrefined++;
+    sim -> nfinesteps += t1 - t0;
+    sim -> nregimeagree += regime(sim, sim -> grid, items, sim -> size * sim -> size) == coarseregime;
+    coarse_restrict(sim, c, 0);
+  }
+}
+
+/* set_samples: estimate the impacts of young agents from nsamples sources
+   drawn in proportion to status, 0 keeps the exact sums. The dense item
+   path only; large vocabularies and the reference build stay exact. */
+void set_samples(Simulation * sim, int nsamples)
+{
+  if (REFERENCE || sim -> sparse || nsamples <= 0)
+    return;
+  int n = sim -> size * sim -> size;
+  sim -> nsamples = max(nsamples, 2);
+  sim -> aliasprob = (double *) malloc(n * sizeof(double));
+  sim -> alias = (int *) malloc(n * sizeof(int));
+  sim -> eligible = (int *) malloc(sim -> nitems * sizeof(int));
+  sim -> sebuf = (float *) malloc(IMPACT_CHUNK * sizeof(float));
+  assert(sim -> aliasprob && sim -> alias && sim -> eligible && sim -> sebuf);
+  sim -> aliasdirty = 1;
 }
 
 void run(Simulation * sim)
 {
+  run_begin(sim);
+  advance(sim, sim -> nsteps);
+  end_sim(sim);
+}
+
+/* set_series: keep the short report in memory as well, one row per
+   report: step 0 and every step after it */
+void set_series(Simulation * sim)
+{
+  if (sim -> seriesitems)
+    return;
+  int rows = sim -> nsteps + 1;
+  sim -> seriesitems = (int *) calloc(rows * sim -> nitems, sizeof(int));
+  sim -> seriesmostfrequent = (int *) calloc(rows, sizeof(int));
+  sim -> serieshomog = (float *) calloc(rows, sizeof(float));
+  assert(sim -> seriesitems && sim -> seriesmostfrequent && sim -> serieshomog);
+}
+
+/* run_begin, run_steps, run_end: run() in pieces, for a caller that
+   looks at the grid in between; free_sim() frees what run_end()
+   leaves */
+void run_begin(Simulation * sim)
+{
+  if (AUTOTUNE)
+    autotune(sim);
   report(sim);
-  while (sim -> currentstep++ < sim -> nsteps) {
-    step(sim);
-    report(sim);
+}
+
+/* run_steps: up to n more steps, the number taken */
+int run_steps(Simulation * sim, int n)
+{
+  int from = sim -> currentstep;
+  advance(sim, min(sim -> nsteps, from + n));
+  return sim -> currentstep - from;
+}
+
+void run_end(Simulation * sim)
+{
+  reportfinal(sim);
+  fclose(sim -> shortreportFP);
+  if (LONGREPORT)
+    fclose(sim -> longreportFP);
+  if (NUMAREPORT) {
+    int n = sim -> size * sim -> size;
+    void * buffers[4] = {sim -> grid, sim -> cohorts, sim -> pendidx, sim -> pending};
+    size_t sizes[4] = {n * sizeof(Agent), n * sizeof(int), n * sizeof(int), n * sizeof(Agent)};
+    numa_report(sim -> finalreportFP, &sim -> numastat, buffers, sizes, 4);
+  }
+  fclose(sim -> finalreportFP);
+  if (EVENTREPORT)
+    eventlog_close(sim -> eventlog);
+}
+
+/* run_branches: run the burn-in once, then fork a process per (bias,
+   murate) variant. A branch continues on a copy-on-write image of the
+   burnt-in grid with its own random stream; its reports are the burn-in
+   reports followed by its own steps, under type names short_branch_k etc.
+   The burn-in reports themselves are kept, without a final report. */
+void run_branches(Simulation * sim, int burnin, int nbranches, float * biases, float * murates, char * path)
+{
+  if (AUTOTUNE)
+    autotune(sim);
+  report(sim);
+  advance(sim, min(burnin, sim -> nsteps));
+
+  fflush(sim -> shortreportFP);
+  if (LONGREPORT)
+    fflush(sim -> longreportFP);
+  if (EVENTREPORT)
+    fflush(sim -> eventlog -> fp);
+  int maxjobs = max(1, (int) sysconf(_SC_NPROCESSORS_ONLN));
+  int k, running = 0, failed = 0, status;
+  for (k = 0; k < nbranches; ++k) {
+    if (running == maxjobs) {
+      wait(&status);
+      failed += !WIFEXITED(status) || WEXITSTATUS(status);
+      running--;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+      branch(sim, k, biases[k], murates[k], path);
+      exit(EXIT_SUCCESS);
+    }
+    running++;
+  }
+  while (running-- > 0) {
+    wait(&status);
+    failed += !WIFEXITED(status) || WEXITSTATUS(status);
+  }
+
+  // the parent only holds the shared burn-in
+  fclose(sim -> shortreportFP);
+  if (LONGREPORT)
+    fclose(sim -> longreportFP);
+  if (EVENTREPORT)
+    eventlog_close(sim -> eventlog);
+  fclose(sim -> finalreportFP);
+  char * finalreport = makefilename(sim, path, "final");
+  unlink(finalreport);
+  free(finalreport);
+  free_sim(sim);
+  if (failed) {
+    fprintf(stderr,"%d of %d branches failed\n",failed,nbranches);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* advance: step and report up to laststep */
+static void advance(Simulation * sim, int laststep)
+{
+  if (sim -> coarse) {
+    multigrid(sim, laststep);
+    return;
+  }
+  TorusModel model = {sim,
+		      (void (*)(void *)) step,
+		      (void (*)(void *)) report,
+		      &sim -> currentstep,
+		      &sim -> numastat};
+  torus_advance(&model, laststep);
+}
+
+/* branch: continue the forked burn-in state as branch k */
+static void branch(Simulation * sim, int k, float bias, float murate, char * path)
+{
+  // branches run side by side, one thread each
+#ifdef _OPENMP
+  omp_set_num_threads(1);
+#endif
+  char * types[3] = {"short", "long", "events"};
+  char * from[3];
+  char type[64];
+  int t;
+  for (t = 0; t < 3; ++t)
+    from[t] = makefilename(sim, path, types[t]);
+  fclose(sim -> finalreportFP);
+
+  sim -> bias = bias;
+  sim -> murate = murate;
+  for (t = 0; t < 3; ++t) {
+    sprintf(type, "%s_branch_%d", types[t], k);
+    char * to = makefilename(sim, path, type);
+    switch(t) {
+    case 0:
+      sim -> shortreportFP = branchcopy(sim -> shortreportFP, from[t], to, "w");
+      if (sim -> metrics) { // a segment of its own, the parent keeps the burn-in's
+	metrics_close(sim -> metrics);
+	sim -> metrics = metrics_open(MODEL_SOCIMPACT, sim -> nsteps, to);
+      }
+      break;
+    case 1:
+      if (LONGREPORT)
+	sim -> longreportFP = branchcopy(sim -> longreportFP, from[t], to, "w");
+      break;
+    default:
+      if (EVENTREPORT)
+	sim -> eventlog -> fp = branchcopy(sim -> eventlog -> fp, from[t], to, "wb");
+      break;
+    }
+    free(from[t]);
+    free(to);
+  }
+  sprintf(type, "final_branch_%d", k);
+  char * finalreport = makefilename(sim, path, type);
+  sim -> finalreportFP = torus_openreport(finalreport, "w");
+  free(finalreport);
+
+  rng_seed(&sim -> rng, RNG_MODE, sim -> seed + (k + 1) * BRANCH_STRIDE);
+  if (sim -> coarse) {
+    sim -> coarse -> bias = bias;
+    sim -> coarse -> murate = murate;
+    rng_seed(&sim -> coarse -> rng, RNG_MODE, sim -> seed + (k + 1) * BRANCH_STRIDE + COARSE_STRIDE);
   }
+  advance(sim, sim -> nsteps);
   end_sim(sim);
 }
 
+/* branchcopy: close the inherited (flushed) report and continue in a copy */
+static FILE * branchcopy(FILE * fp, char * from, char * to, char * mode)
+{
+  fclose(fp);
+  FILE * in = torus_openreport(from, "rb");
+  FILE * out = torus_openreport(to, mode);
+  char buf[1 << 16];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    if (fwrite(buf, 1, n, out) != n) {
+      fprintf(stderr,"Cannot write %s\n",to);
+      exit(EXIT_FAILURE);
+    }
+  fclose(in);
+  return out;
+}
+
 static void step(Simulation * sim)
 {
-  int size = sim -> size;
-  // copy the grid;
-  Agent * newgrid = (Agent *) malloc(size * size * sizeof(Agent));
-  int i;
-  for (i = 0; i < size * size; ++i) {
-    Agent a = {sim -> grid[i].item,sim -> grid[i].status,sim -> grid[i].age};
-    sim -> grid[i] = a;
-  }
-
-  // update the agents
-  for (i = 0; i < size * size; ++i) {
-    // determine if item should be reset
-    int item = sim -> grid[i].item;
-    if (sim -> grid[i].age <= 2) {
-      float impacts[sim -> nitems];
-      collectimpacts(sim, i, impacts);
-      switch(sim -> learningmode) {
-      case 0: // maximize - maximize
-	if (rand01() > sim -> murate) { // normal procedure: maximize
-	  item = maxidx_float(impacts, sim -> nitems);
-	} else { // exception procedure: maximize
-	  impacts[maxidx_float(impacts, sim -> nitems)] = -1.0;
-	  item = maxidx_float(impacts, sim -> nitems); // take second best
+  int maxage = sim -> maxage;
+  int clock = sim -> ageclock % maxage;
+
+  // only three cohorts can change: ages 1 and 2 learn, age maxage is reborn
+  int phases[3];
+  int nphases = 0;
+  int ages[3] = {1, 2, maxage};
+  int k, p;
+  for (k = 0; k < 3; ++k) {
+    if (ages[k] > maxage)
+      continue;
+    int phase = ((ages[k] - 1 - clock) % maxage + maxage) % maxage;
+    for (p = 0; p < nphases && phases[p] != phase; ++p)
+      ;
+    if (p == nphases)
+      phases[nphases++] = phase;
+  }
+  int heads[3];
+  for (p = 0; p < nphases; ++p)
+    heads[p] = sim -> cohortstart[phases[p]];
+
+  // gather the agents of those cohorts in index order
+  int npending = 0;
+  while (1) {
+    int i = -1;
+    int from = -1;
+    for (p = 0; p < nphases; ++p) {
+      if (heads[p] < sim -> cohortstart[phases[p] + 1]
+	  && (i < 0 || sim -> cohorts[heads[p]] < i)) {
+	i = sim -> cohorts[heads[p]];
+	from = p;
+      }
+    }
+    if (i < 0)
+      break;
+    heads[from]++;
+    sim -> pendidx[npending++] = i;
+  }
+
+  // update them into pending, chunk by chunk: young agents collect their
+  // impacts in parallel, then the decisions and rebirths, which draw
+  // random numbers, run in index order
+  int dense = !sim -> sparse;
+  int sampled = sim -> nsamples > 0;
+  int quadtree = !sampled && sim -> qtnodes;
+  int check = (sampled || quadtree) && ISCHECK && sim -> ageclock % ISCHECK == 0;
+  if (dense && sim -> simd >= 0)
+    sources_simd(sim);
+  if (sampled) {
+    // the status table only changes at rebirths, the item counts every step
+    if (sim -> aliasdirty)
+      buildalias(sim);
+    int newborn = (maxage - clock) % maxage;
+    for (k = 0; k < sim -> nitems; ++k)
+      sim -> eligible[k] = 0;
+    for (k = 0; k < sim -> size * sim -> size; ++k)
+      if (sim -> grid[k].phase != newborn)
+	sim -> eligible[sim -> grid[k].item]++;
+  }
+  int start;
+  for (start = 0; start < npending; start += IMPACT_CHUNK) {
+    int end = min(start + IMPACT_CHUNK, npending);
+    if (dense) {
+#pragma omp parallel for schedule(dynamic, 16)
+      for (k = start; k < end; ++k)
+	if (agentage(sim, sim -> pendidx[k]) <= 2) {
+	  if (sampled)
+	    collectimpacts_is(sim, sim -> pendidx[k], sim -> impactbuf + (k - start) * sim -> nitems, &sim -> sebuf[k - start]);
+	  else if (quadtree)
+	    collectimpacts_qt(sim, sim -> pendidx[k], sim -> impactbuf + (k - start) * sim -> nitems);
+	  else
+	    collectimpacts(sim, sim -> pendidx[k], sim -> impactbuf + (k - start) * sim -> nitems);
 	}
-	break;
-      case 1: // maximize - sample
-	if (rand01() > sim -> murate) { // normal procedure: maximize
-	  item = maxidx_float(impacts, sim -> nitems);
-	} else { // exception : sample
-	  impacts[maxidx_float(impacts, sim -> nitems)] = -1.0;
-	  item = sample(sim, impacts);
+    }
+    for (k = start; k < end; ++k) {
+      int i = sim -> pendidx[k];
+      int age = agentage(sim, i);
+      // determine if item should be reset
+      int item = sim -> grid[i].item;
+      if (age <= 2) {
+	float * impacts = sim -> impactbuf + (k - start) * sim -> nitems;
+	if (check) {
+	  float exact[sim -> nitems];
+	  collectimpacts(sim, i, exact);
+	  sim -> nchecked++;
+	  sim -> nagree += torus_maxidx_float(exact, sim -> nitems) == torus_maxidx_float(impacts, sim -> nitems);
 	}
-	break;
-      case 2: // sample - sample
-	item = sample(sim, impacts);
-	break;
+	if (sampled) {
+	  sim -> sesum += sim -> sebuf[k - start];
+	  sim -> nestimates++;
+	  sim -> numastat.bytes += (double) sim -> nsamples * sizeof(Agent);
+	} else
+	  sim -> numastat.bytes += (double) sim -> size * sim -> size * sizeof(Agent);
+	item = learn(sim, i, item, impacts);
       }
-    }
-    // determine status
-    int status = sim -> grid[i].status;
-    
-    // determine age
-    int age = 1 + sim -> grid[i].age;
-    if (age > sim -> maxage) {
-      age = 1;
-      // determine new status
-      switch (sim -> statdistr) {
-      case 0: // all the same
-	status = 1;
-	break;
-      case 2: // hypers
-	if (rand01() < HYPER_THRESH) {
-	  status = sim -> size * sim -> size * 25;
+      // determine status
+      int status = sim -> grid[i].status;
+      if (age + 1 > maxage) {
+	// determine new status
+	rng_keyed(&sim -> rng, sim -> seed, i, sim -> currentstep, CRN_STATUS);
+	switch (sim -> statdistr) {
+	case 0: // all the same
+	  status = 1;
+	  break;
+	case 2: // hypers
+	  if (rng_float(&sim -> rng) < HYPER_THRESH) {
+	    status = sim -> size * sim -> size * 25;
+	    break;
+	  }
+	case 1: // poisson approx
+	  status = (int) pow(rng_float(&sim -> rng) * (sim -> size - 1) + 1, 2.0);
 	  break;
 	}
-      case 1: // poisson approx
-	status = (int) pow(rand01() * (sim -> size - 1) + 1, 2.0);
-	break;
+	if (status != sim -> grid[i].status)
+	  sim -> aliasdirty = 1;
       }
+      Agent a = {item,status,sim -> grid[i].phase};
+      sim -> pending[k] = a;
     }
-    Agent a = {item,status,age};
-    newgrid[i] = a;
   }
 
-  free(sim -> grid);
-  sim -> grid = newgrid;
+  if (EVENTREPORT)
+    reportevents(sim, npending);
+  for (k = 0; k < npending; ++k) {
+    int i = sim -> pendidx[k];
+    if (sim -> qtnodes)
+      qt_update(sim, i, &sim -> grid[i], &sim -> pending[k]);
+    sim -> grid[i] = sim -> pending[k];
+  }
+  sim -> ageclock++;
+}
+
+/* learn: new item for a young agent from its collected impacts */
+static int learn(Simulation * sim, int idx, int item, float * impacts)
+{
+  if (sim -> sparse)
+    return learn_sparse(sim, idx, item);
+
+  rng_keyed(&sim -> rng, sim -> seed, idx, sim -> currentstep, CRN_EXCEPTION);
+  switch(sim -> learningmode) {
+  case 0: // maximize - maximize
+    if (rng_float(&sim -> rng) > sim -> murate) { // normal procedure: maximize
+      item = torus_maxidx_float(impacts, sim -> nitems);
+    } else { // exception procedure: maximize
+      impacts[torus_maxidx_float(impacts, sim -> nitems)] = -1.0;
+      item = torus_maxidx_float(impacts, sim -> nitems); // take second best
+    }
+    break;
+  case 1: // maximize - sample
+    if (rng_float(&sim -> rng) > sim -> murate) { // normal procedure: maximize
+      item = torus_maxidx_float(impacts, sim -> nitems);
+    } else { // exception : sample
+      impacts[torus_maxidx_float(impacts, sim -> nitems)] = -1.0;
+      rng_keyed(&sim -> rng, sim -> seed, idx, sim -> currentstep, CRN_SAMPLE);
+      item = sample(sim, impacts);
+    }
+    break;
+  case 2: // sample - sample
+    rng_keyed(&sim -> rng, sim -> seed, idx, sim -> currentstep, CRN_SAMPLE);
+    item = sample(sim, impacts);
+    break;
+  }
+  return item;
+}
+
+/* agentage: age of agent idx in the current grid, ages run 1..maxage */
+static int agentage(Simulation * sim, int idx)
+{
+  return (sim -> grid[idx].phase + sim -> ageclock) % sim -> maxage + 1;
 }
 
 /* sample index from impacts, -1 indicates nonvalid index */
@@ -271,7 +1043,7 @@ static int sample(Simulation * sim, float * impacts)
 
   // now sample one index:
   while(1) {
-    float r = rand01();
+    float r = rng_float(&sim -> rng);
     for (i = 0; i < sim -> nitems; ++i) {
       if (normalized[i] > r)
 	return i;
@@ -281,30 +1053,223 @@ static int sample(Simulation * sim, float * impacts)
   }
 }
 
-static int maxidx_float(float * arr, int n)
+/*
+ * sparse item path
+ *
+ * With many items only the ones present among the sources are non-zero,
+ * so impacts are kept in sim -> itemimpacts for the items listed in
+ * sim -> touched (sorted ascending) and all other items are implicitly 0.
+ * Selection and sampling follow torus_maxidx_float() and sample() on the
+ * virtual dense vector, at a cost in the number of touched items.
+ */
+static int learn_sparse(Simulation * sim, int idx, int item)
 {
-  int maxidx = 0;
-  int i;
-  for (i = 1; i < n; ++i) {
-    if (arr[i] > arr[maxidx])
-      maxidx = i;
+  int n = collectimpacts_sparse(sim, idx);
+  int best, second;
+  rng_keyed(&sim -> rng, sim -> seed, idx, sim -> currentstep, CRN_EXCEPTION);
+  switch(sim -> learningmode) {
+  case 0: // maximize - maximize
+    top2_sparse(sim, n, &best, &second);
+    item = (rng_float(&sim -> rng) > sim -> murate) ? best : second;
+    break;
+  case 1: // maximize - sample
+    if (rng_float(&sim -> rng) > sim -> murate) {
+      top2_sparse(sim, n, &best, &second);
+      item = best;
+    } else {
+      top2_sparse(sim, n, &best, &second);
+      rng_keyed(&sim -> rng, sim -> seed, idx, sim -> currentstep, CRN_SAMPLE);
+      item = sample_sparse(sim, n, best);
+    }
+    break;
+  case 2: // sample - sample
+    rng_keyed(&sim -> rng, sim -> seed, idx, sim -> currentstep, CRN_SAMPLE);
+    item = sample_sparse(sim, n, -1);
+    break;
   }
-  return maxidx;
+  return item;
 }
 
-static int maxidx_int(int * arr, int n)
+/* collectimpacts_sparse: collectimpacts() into the touched items only,
+   returns the number of touched items */
+static int collectimpacts_sparse(Simulation * sim, int idx)
 {
-  int maxidx = 0;
-  int i;
-  for (i = 1; i < n; ++i) {
-    if (arr[i] > arr[maxidx])
-      maxidx = i;
+  int * counts = sim -> itemcounts;
+  float * arr = sim -> itemimpacts;
+  int * touched = sim -> touched;
+  int n = 0;
+  int newborn = (sim -> maxage - sim -> ageclock % sim -> maxage) % sim -> maxage; // age 1
+  int j;
+  for (j = 0; j < sim -> size * sim -> size; ++j) {
+    if (idx != j) {
+      if (sim -> grid[j].phase != newborn) { // age > 1
+	int item = sim -> grid[j].item;
+	if (counts[item]++ == 0) {
+	  touched[n++] = item;
+	  arr[item] = 0.0;
+	}
+	float dist = torus_distance(idx,j,sim -> size);
+	arr[item] += (float) sim -> grid[j].status / (dist * dist);
+      }
+    }
+  }
+  qsort(touched, n, sizeof(int), cmp_int);
+
+  int specialitem = sim -> nitems - 1; // only item with bias
+  int k;
+  for (k = 0; k < n; ++k) {
+    int item = touched[k];
+    if (item == specialitem)
+      arr[item] = sim -> bias * pow(counts[item],sim -> normimpact) * (arr[item] / ((float) counts[item]));
+    else
+      arr[item] = pow(counts[item], sim -> normimpact) * (arr[item] / ((float) counts[item]));
+    counts[item] = 0;
+  }
+  return n;
+}
+
+/* top2_sparse: best and second best index in one pass over the touched
+   items and the two lowest untouched ones; ties go to the lowest index
+   as with repeated torus_maxidx_float() */
+static void top2_sparse(Simulation * sim, int n, int * best, int * second)
+{
+  float * arr = sim -> itemimpacts;
+  int * touched = sim -> touched;
+  int zeros[2];
+  int nzeros = 0;
+  int i, k = 0;
+  for (i = 0; i < sim -> nitems && nzeros < 2; ++i) {
+    if (k < n && touched[k] == i)
+      k++;
+    else
+      zeros[nzeros++] = i;
+  }
+
+  int b = -1, s = -1;
+  float bval = 0.0, sval = 0.0;
+  int kz = 0;
+  k = 0;
+  while (k < n || kz < nzeros) {
+    int idx;
+    float val;
+    if (kz < nzeros && (k >= n || zeros[kz] < touched[k])) {
+      idx = zeros[kz++];
+      val = 0.0;
+    } else {
+      idx = touched[k++];
+      val = arr[idx];
+    }
+    if (b < 0 || val > bval) {
+      s = b;
+      sval = bval;
+      b = idx;
+      bval = val;
+    } else if (s < 0 || val > sval) {
+      s = idx;
+      sval = val;
+    }
+  }
+  *best = b;
+  *second = s;
+}
+
+/* sample_sparse: sample() with excl (-1: none) treated as impact -1.0,
+   using a binary search over the cumulative mass of the touched items.
+   As in sample(), every item below EPSILON -- the excluded one included --
+   receives the reserved mass per zero. */
+static int sample_sparse(Simulation * sim, int n, int excl)
+{
+  float * arr = sim -> itemimpacts;
+  int * touched = sim -> touched;
+  float sum = 0.0;
+  int nzeros = sim -> nitems - n;
+  int k;
+  for (k = 0; k < n; ++k) {
+    float val = (touched[k] == excl) ? -1.0 : arr[touched[k]];
+    if (fabs(val) <= EPSILON)
+      nzeros++;
+    if (val > 0)
+      sum += val;
+  }
+  if (excl >= 0 && !bsearch(&excl, touched, n, sizeof(int), cmp_int))
+    nzeros--; // untouched, but not zero
+
+  float reservedmass = (sum / (1.0 - sim -> murate)) - sum;
+  float massperzero = reservedmass / ((float) nzeros);
+  sum += reservedmass;
+
+  if (fabs(sum) <= EPSILON) {
+    while(1) {
+      int i = (int) (rng_float(&sim -> rng) * sim -> nitems);
+      if (i < sim -> nitems)
+	return i;
+    }
+  }
+
+  // compact touched to the items with explicit mass, cummass[p] is the
+  // explicit mass before the p-th of them
+  float zeromass = massperzero / sum;
+  float * cum = sim -> cummass;
+  int nexpl = 0;
+  cum[0] = 0.0;
+  for (k = 0; k < n; ++k) {
+    int item = touched[k];
+    if (item == excl || arr[item] < EPSILON)
+      continue;
+    touched[nexpl] = item;
+    cum[nexpl + 1] = cum[nexpl] + arr[item] / sum;
+    nexpl++;
+  }
+
+  // now sample one index:
+  while(1) {
+    float r = rng_float(&sim -> rng);
+    // p: last explicit item starting at or before r
+    int lo = 0, hi = nexpl;
+    while (lo < hi) {
+      int mid = (lo + hi) / 2;
+      if (cum[mid] + ZEROMASS(touched[mid] - mid, zeromass) <= r)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+    int p = lo - 1;
+    int first = 0;
+    if (p >= 0) {
+      r -= cum[p] + ZEROMASS(touched[p] - p, zeromass);
+      if (r < cum[p + 1] - cum[p])
+	return touched[p];
+      r -= cum[p + 1] - cum[p];
+      first = touched[p] + 1;
+    }
+    int limit = (p + 1 < nexpl) ? touched[p + 1] : sim -> nitems;
+    if (first < limit && zeromass > 0) {
+      int i = first + (int) (r / zeromass);
+      if (i < limit)
+	return i;
+    }
+    if (p + 1 < nexpl) // rounding at the boundary
+      return touched[p + 1];
   }
-  return maxidx;
+}
+
+static int cmp_int(const void * vp1, const void * vp2)
+{
+  int i1 = *(const int *) vp1;
+  int i2 = *(const int *) vp2;
+  return (i1 > i2) - (i1 < i2);
 }
 
 static void collectimpacts(Simulation *  sim, int idx, float * arr)
 {
+  if (sim -> fxkernel) {
+    collectimpacts_fixed(sim, idx, arr);
+    return;
+  }
+  if (sim -> simd >= 0) {
+    collectimpacts_simd(sim, idx, arr);
+    return;
+  }
   int sums[sim -> nitems];
   float status_over_dist_sums[sim -> nitems];
   int i;
@@ -313,12 +1278,13 @@ static void collectimpacts(Simulation *  sim, int idx, float * arr)
     status_over_dist_sums[i] = 0.0;
   }
 
+  int newborn = (sim -> maxage - sim -> ageclock % sim -> maxage) % sim -> maxage; // age 1
   int j;
   for (j = 0; j < sim -> size * sim -> size; ++j) {
     if (idx != j) {
-      if (sim -> grid[j].age > 1) {
+      if (sim -> grid[j].phase != newborn) { // age > 1
 	sums[sim -> grid[j].item]++;
-	float dist = distance(idx,j,sim -> size);
+	float dist = torus_distance(idx,j,sim -> size);
 	status_over_dist_sums[sim -> grid[j].item] += (float) sim -> grid[j].status / (dist * dist);
       }
     }
@@ -337,6 +1303,451 @@ static void collectimpacts(Simulation *  sim, int idx, float * arr)
   }
 }
 
+/*
+ * collectimpacts_simd: collectimpacts() for vocabularies of up to
+ * SIMD_MAXLABELS items. Item counts come from the per-step source counts;
+ * the status over squared distance sums run row by row through
+ * simd_labelsums(), with the squared distances of a row read straight
+ * from the table. The sums are added in lane order rather than source
+ * order, so they differ from collectimpacts() in the last bits, but not
+ * between the AVX-512, AVX2 and scalar variants.
+ */
+static void collectimpacts_simd(Simulation * sim, int idx, float * arr)
+{
+  int size = sim -> size;
+  int nitems = sim -> nitems;
+  float acc[SIMD_MAXLABELS * SIMD_LANES];
+  int i, x;
+  for (i = 0; i < nitems * SIMD_LANES; ++i)
+    acc[i] = 0.0;
+  int xi = idx / size;
+  int yi = idx % size;
+  for (x = 0; x < size; ++x) {
+    const float * den = sim -> dist2 + ((x - xi + size) % size) * 2 * size + size - yi;
+    simd_labelsums(sim -> simd, sim -> srcitem + x * size, sim -> srcstatus + x * size, den, size, nitems, acc);
+  }
+  float status_over_dist_sums[nitems];
+  simd_lanesum(acc, nitems, status_over_dist_sums);
+
+  for (i = 0; i < nitems; ++i) {
+    int count = sim -> srccount[i] - (i == sim -> srcitem[idx]);
+    float weight = (i == nitems - 1) ? sim -> bias : 1.0;
+    if (count != 0)
+      arr[i] = weight * pow(count, sim -> normimpact) * (status_over_dist_sums[i] / ((float) count));
+    else
+      arr[i] = 0.0;
+  }
+}
+
+/* sources_simd: item and status of every source for this step, ages
+   above 1 only */
+static void sources_simd(Simulation * sim)
+{
+  int newborn = (sim -> maxage - sim -> ageclock % sim -> maxage) % sim -> maxage; // age 1
+  int j;
+  for (j = 0; j < sim -> nitems; ++j)
+    sim -> srccount[j] = 0;
+  for (j = 0; j < sim -> size * sim -> size; ++j) {
+    Agent * a = &sim -> grid[j];
+    sim -> srcitem[j] = (a -> phase != newborn) ? a -> item : -1;
+    if (sim -> fxstatus)
+      sim -> fxstatus[j] = a -> status;
+    else
+      sim -> srcstatus[j] = (float) a -> status;
+    if (a -> phase != newborn)
+      sim -> srccount[a -> item]++;
+  }
+}
+
+/*
+ * collectimpacts_fixed: collectimpacts() with the status over squared
+ * distance sums in fixed point. Statuses and squared distances are
+ * integers; the kernel table holds 1 / d^2 scaled by 2^fxshift and
+ * rounded, so a source adds status * kernel, an integer, and the sums are
+ * exact whatever order they are added in: by row, in any vector width,
+ * or split over threads. Only the conversion to float at the end rounds.
+ */
+static void collectimpacts_fixed(Simulation * sim, int idx, float * arr)
+{
+  int size = sim -> size;
+  int nitems = sim -> nitems;
+  unsigned long long acc[nitems];
+  int i, x;
+  for (i = 0; i < nitems; ++i)
+    acc[i] = 0;
+  int xi = idx / size;
+  int yi = idx % size;
+  for (x = 0; x < size; ++x) {
+    const unsigned int * kern = sim -> fxkernel + ((x - xi + size) % size) * 2 * size + size - yi;
+    simd_fixedsums(sim -> simd, sim -> srcitem + x * size, sim -> fxstatus + x * size, kern, size, nitems, acc);
+  }
+
+  for (i = 0; i < nitems; ++i) {
+    int count = sim -> srccount[i] - (i == sim -> srcitem[idx]);
+    float weight = (i == nitems - 1) ? sim -> bias : 1.0;
+    float status_over_dist_sum = (float) ldexp((double) acc[i], -sim -> fxshift);
+    if (count != 0)
+      arr[i] = weight * pow(count, sim -> normimpact) * (status_over_dist_sum / ((float) count));
+    else
+      arr[i] = 0.0;
+  }
+}
+
+/* fixed_build: the sources and the kernel table, with as many fraction
+   bits as keep the sum of the largest status over all sources below
+   2^64; the agent itself is at distance 0 and gets kernel 0 */
+static void fixed_build(Simulation * sim)
+{
+  int size = sim -> size;
+  int n = size * size;
+  double maxstatus = (sim -> statdistr == 0) ? 1.0 : (double) n * ((sim -> statdistr == 2) ? 25 : 1);
+  assert(maxstatus < 4294967296.0);
+  sim -> simd = simd_level();
+  sim -> srcitem = (int *) malloc(n * sizeof(int));
+  sim -> srccount = (int *) malloc(sim -> nitems * sizeof(int));
+  sim -> fxstatus = (unsigned int *) malloc(n * sizeof(unsigned int));
+  sim -> fxkernel = (unsigned int *) numa_alloc(2 * n * sizeof(unsigned int));
+  assert(sim -> srcitem && sim -> srccount && sim -> fxstatus && sim -> fxkernel);
+  double kernsum = 0.0;
+  int dx, dy, e;
+  for (dx = 0; dx < size; ++dx)
+    for (dy = 0; dy < size; ++dy)
+      if (dx || dy)
+	kernsum += 1.0 / (min(dx, size - dx) * min(dx, size - dx) + min(dy, size - dy) * min(dy, size - dy));
+  // rounding adds at most 1/2 per source
+  int shift = FIXED_MAXSHIFT;
+  while (shift > 0 && maxstatus * (ldexp(kernsum, shift) + n) >= ldexp(1.0, 64))
+    shift--;
+  sim -> fxshift = shift;
+  for (dx = 0; dx < size; ++dx)
+    for (e = 0; e < 2 * size; ++e) {
+      int x = min(dx, size - dx);
+      int y = min(e % size, size - e % size);
+      long d2 = (long) x * x + (long) y * y;
+      sim -> fxkernel[dx * 2 * size + e] = d2 ? (unsigned int) llround(ldexp(1.0, shift) / d2) : 0;
+    }
+}
+
+/*
+ * quadtree impacts
+ *
+ * After the transient the grid is mostly large single-item regions, but
+ * murate keeps them sprinkled with other items. The quadtree splits the
+ * torus into blocks down to single agents; every block keeps, per item
+ * and birth phase, its agent count and status sum. For a young agent a
+ * block far enough away -- its extent below QUADTREE times its distance
+ * -- adds its sources at once: their counts exactly, their status over
+ * squared distance sums as each item's mean status over the block times
+ * the kernel summed over the block, which the prefix table gives in four
+ * lookups. That is exact for a block of one item and equal statuses.
+ * Nearer blocks are opened, single agents are summed exactly. Changes
+ * are applied to the tree at the end of every step, from the agent up.
+ */
+static void qt_build(Simulation * sim)
+{
+  int size = sim -> size;
+  size_t n = (size_t) size * size;
+  sim -> qtnodes = (QtNode *) malloc(2 * n * sizeof(QtNode));
+  sim -> qtleaf = (int *) malloc(n * sizeof(int));
+  int side = 2 * size + 1;
+  sim -> qtkernel = (double *) numa_alloc((size_t) side * side * sizeof(double));
+  assert(sim -> qtnodes && sim -> qtleaf && sim -> qtkernel);
+  sim -> nqtnodes = 1;
+  sim -> nqtslots = 0;
+  sim -> qtnodes[0].parent = -1;
+  qt_split(sim, 0, 0, 0, size, size);
+
+  // sums for the internal nodes only, children come after their parent
+  size_t cells = (size_t) sim -> nqtslots * sim -> nitems * sim -> maxage;
+  sim -> qtcount = (int *) malloc(cells * sizeof(int));
+  sim -> qtstatus = (double *) malloc(cells * sizeof(double));
+  assert(sim -> qtcount && sim -> qtstatus);
+  int k;
+  for (k = sim -> nqtnodes - 1; k >= 0; --k)
+    if (sim -> qtnodes[k].slot >= 0)
+      qt_pull(sim, k);
+
+  // qtkernel[a * side + b]: 1 / d^2 summed over displacements below a, b
+  double * p = sim -> qtkernel;
+  int a, b;
+  for (a = 1; a < side; ++a)
+    for (b = 1; b < side; ++b) {
+      int d = ((a - 1) % size) * size + (b - 1) % size;
+      float dist = torus_distance(0, d, size);
+      double g = (d == 0) ? 0.0 : 1.0 / (dist * dist);
+      p[a * side + b] = g + p[(a - 1) * side + b] + p[a * side + b - 1] - p[(a - 1) * side + b - 1];
+    }
+}
+
+/* qt_split: fill node k with the block and split it into up to four
+   children, allocated together; qt_build() pulls the sums */
+static void qt_split(Simulation * sim, int k, int x0, int y0, int w, int h)
+{
+  QtNode * node = &sim -> qtnodes[k];
+  node -> x0 = x0;
+  node -> y0 = y0;
+  node -> w = w;
+  node -> h = h;
+  if (w == 1 && h == 1) {
+    node -> child = -1;
+    node -> nchild = 0;
+    node -> slot = -1;
+    sim -> qtleaf[x0 * sim -> size + y0] = k;
+  } else {
+    node -> slot = sim -> nqtslots++;
+    int wx[2] = {(w + 1) / 2, w / 2};
+    int hy[2] = {(h + 1) / 2, h / 2};
+    int nx = (w > 1) ? 2 : 1;
+    int ny = (h > 1) ? 2 : 1;
+    node -> child = sim -> nqtnodes;
+    node -> nchild = nx * ny;
+    sim -> nqtnodes += nx * ny;
+    int i, j;
+    for (i = 0; i < nx; ++i)
+      for (j = 0; j < ny; ++j) {
+	int c = node -> child + i * ny + j;
+	sim -> qtnodes[c].parent = k;
+	qt_split(sim, c, x0 + i * wx[0], y0 + j * hy[0], (nx == 1) ? w : wx[i], (ny == 1) ? h : hy[j]);
+      }
+  }
+}
+
+/* qt_pull: counts and status sums of internal node k from its children,
+   leaves from their agents */
+static void qt_pull(Simulation * sim, int k)
+{
+  QtNode * node = &sim -> qtnodes[k];
+  size_t stride = (size_t) sim -> nitems * sim -> maxage;
+  int * count = sim -> qtcount + node -> slot * stride;
+  double * status = sim -> qtstatus + node -> slot * stride;
+  size_t e;
+  int c;
+  for (e = 0; e < stride; ++e) {
+    count[e] = 0;
+    status[e] = 0.0;
+  }
+  for (c = node -> child; c < node -> child + node -> nchild; ++c) {
+    QtNode * child = &sim -> qtnodes[c];
+    if (child -> slot < 0) {
+      Agent * a = &sim -> grid[child -> x0 * sim -> size + child -> y0];
+      count[a -> item * sim -> maxage + a -> phase]++;
+      status[a -> item * sim -> maxage + a -> phase] += a -> status;
+      continue;
+    }
+    for (e = 0; e < stride; ++e) {
+      count[e] += sim -> qtcount[child -> slot * stride + e];
+      status[e] += sim -> qtstatus[child -> slot * stride + e];
+    }
+  }
+}
+
+/* qt_update: agent i goes from old to new, in the internal nodes on its
+   path to the root; its leaf is the grid itself */
+static void qt_update(Simulation * sim, int i, Agent * old, Agent * new)
+{
+  if (old -> item == new -> item && old -> status == new -> status)
+    return;
+  size_t stride = (size_t) sim -> nitems * sim -> maxage;
+  int from = old -> item * sim -> maxage + old -> phase;
+  int to = new -> item * sim -> maxage + new -> phase;
+  int k;
+  for (k = sim -> qtnodes[sim -> qtleaf[i]].parent; k >= 0; k = sim -> qtnodes[k].parent) {
+    size_t cell = sim -> qtnodes[k].slot * stride;
+    sim -> qtcount[cell + from]--;
+    sim -> qtstatus[cell + from] -= old -> status;
+    sim -> qtcount[cell + to]++;
+    sim -> qtstatus[cell + to] += new -> status;
+  }
+}
+
+/* qt_kernel: 1 / d^2 summed over the w by h displacements from dx, dy */
+static double qt_kernel(Simulation * sim, int dx, int dy, int w, int h)
+{
+  int side = 2 * sim -> size + 1;
+  double * p = sim -> qtkernel;
+  return p[(dx + w) * side + dy + h] - p[dx * side + dy + h] - p[(dx + w) * side + dy] + p[dx * side + dy];
+}
+
+/* qt_gap: torus distance from x to the nearest of x0..x0+w-1 */
+static int qt_gap(int x, int x0, int w, int size)
+{
+  int ahead = (x0 - x + size) % size; // x0 lies ahead of x by this much
+  if (ahead == 0 || ahead + w > size)
+    return 0;
+  return min(ahead, size - (ahead + w - 1));
+}
+
+/* collectimpacts_qt: collectimpacts() from the quadtree */
+static void collectimpacts_qt(Simulation * sim, int idx, float * arr)
+{
+  int size = sim -> size;
+  int maxage = sim -> maxage;
+  int nitems = sim -> nitems;
+  size_t stride = (size_t) nitems * maxage;
+  int newborn = (maxage - sim -> ageclock % maxage) % maxage; // age 1
+  int xi = idx / size;
+  int yi = idx % size;
+  int sums[nitems];
+  double status_over_dist_sums[nitems];
+  int i, p;
+  for (i = 0; i < nitems; ++i) {
+    sums[i] = 0;
+    status_over_dist_sums[i] = 0.0;
+  }
+  int stack[64 * 4]; // up to four children a level, far deeper than any grid
+  int top = 0, visits = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    int k = stack[--top];
+    QtNode * node = &sim -> qtnodes[k];
+    visits++;
+    if (node -> child < 0) {
+      int j = node -> x0 * size + node -> y0;
+      Agent * a = &sim -> grid[j];
+      if (j != idx && a -> phase != newborn) {
+	sums[a -> item]++;
+	float dist = torus_distance(idx, j, size);
+	status_over_dist_sums[a -> item] += (float) a -> status / (dist * dist);
+      }
+      continue;
+    }
+    int gx = qt_gap(xi, node -> x0, node -> w, size);
+    int gy = qt_gap(yi, node -> y0, node -> h, size);
+    if (max(node -> w, node -> h) < QUADTREE * sqrt(gx * gx + gy * gy)) {
+      double kernel = qt_kernel(sim, (node -> x0 - xi + size) % size, (node -> y0 - yi + size) % size, node -> w, node -> h);
+      kernel /= node -> w * node -> h;
+      int * count = sim -> qtcount + node -> slot * stride;
+      double * status = sim -> qtstatus + node -> slot * stride;
+      for (i = 0; i < nitems; ++i)
+	for (p = 0; p < maxage; ++p)
+	  if (p != newborn && count[i * maxage + p]) {
+	    sums[i] += count[i * maxage + p];
+	    status_over_dist_sums[i] += status[i * maxage + p] * kernel;
+	  }
+      continue;
+    }
+    int c;
+    for (c = node -> child + node -> nchild - 1; c >= node -> child; --c)
+      stack[top++] = c;
+  }
+#pragma omp atomic
+  sim -> qtvisits += visits;
+#pragma omp atomic
+  sim -> nestimates++;
+
+  for (i = 0; i < nitems; ++i) {
+    float weight = (i == nitems - 1) ? sim -> bias : 1.0;
+    if (sums[i] != 0)
+      arr[i] = weight * pow(sums[i], sim -> normimpact) * ((float) status_over_dist_sums[i] / ((float) sums[i]));
+    else
+      arr[i] = 0.0;
+  }
+}
+
+/* collectimpacts_is: importance-sampled collectimpacts. Sources j are
+   drawn with probability status_j / W from the alias table; W / d^2 for
+   an eligible source is then an unbiased sample of the status over
+   distance sum of its item. Item counts are exact. se gets the relative
+   standard error of the largest impact. The draws come from a private
+   stream per agent and step, so the main stream and thread count are
+   untouched. */
+static void collectimpacts_is(Simulation * sim, int idx, float * arr, float * se)
+{
+  int nitems = sim -> nitems;
+  double est[nitems], sq[nitems];
+  int i;
+  for (i = 0; i < nitems; ++i) {
+    est[i] = 0.0;
+    sq[i] = 0.0;
+  }
+  int n = sim -> size * sim -> size;
+  int k = sim -> nsamples;
+  int newborn = (sim -> maxage - sim -> ageclock % sim -> maxage) % sim -> maxage; // age 1
+  // keyed like rng_keyed(): agent and clock in separate halves
+  unsigned long long state = rng_mix(sim -> seed + 0x9e3779b97f4a7c15ULL);
+  state = rng_mix(state ^ ((uint64_t) idx << 32 | (uint32_t) sim -> ageclock));
+  int s;
+  for (s = 0; s < k; ++s) {
+    double u = (splitmix64(&state) >> 11) * (1.0 / 9007199254740992.0) * n;
+    int j = (int) u;
+    if (u - j >= sim -> aliasprob[j])
+      j = sim -> alias[j];
+    if (j == idx || sim -> grid[j].phase == newborn)
+      continue;
+    float dist = torus_distance(idx, j, sim -> size);
+    double x = sim -> statustotal / (dist * dist);
+    est[sim -> grid[j].item] += x;
+    sq[sim -> grid[j].item] += x * x;
+  }
+
+  int self = (sim -> grid[idx].phase != newborn) ? sim -> grid[idx].item : -1;
+  int top = 0;
+  for (i = 0; i < nitems; ++i) {
+    int count = sim -> eligible[i] - (i == self);
+    if (count != 0)
+      arr[i] = pow(count, sim -> normimpact) * ((est[i] / k) / ((float) count));
+    else
+      arr[i] = 0.0;
+    if (i == nitems - 1) // only item with bias
+      arr[i] *= sim -> bias;
+    if (arr[i] > arr[top])
+      top = i;
+  }
+  double mean = est[top] / k;
+  double var = (sq[top] / k - mean * mean) / (k - 1);
+  *se = (mean > 0.0) ? sqrt(max(var, 0.0)) / mean : 0.0;
+}
+
+/* buildalias: Vose alias table over the agents' statuses */
+static void buildalias(Simulation * sim)
+{
+  int n = sim -> size * sim -> size;
+  int * small = (int *) malloc(n * sizeof(int));
+  int * large = (int *) malloc(n * sizeof(int));
+  assert(small && large);
+  double total = 0.0;
+  int i;
+  for (i = 0; i < n; ++i)
+    total += sim -> grid[i].status;
+  sim -> statustotal = total;
+  int ns = 0, nl = 0;
+  for (i = 0; i < n; ++i) {
+    sim -> aliasprob[i] = sim -> grid[i].status * n / total;
+    sim -> alias[i] = i;
+    if (sim -> aliasprob[i] < 1.0)
+      small[ns++] = i;
+    else
+      large[nl++] = i;
+  }
+  while (ns > 0 && nl > 0) {
+    int l = small[--ns];
+    int g = large[nl - 1];
+    sim -> alias[l] = g;
+    sim -> aliasprob[g] -= 1.0 - sim -> aliasprob[l];
+    if (sim -> aliasprob[g] < 1.0) {
+      nl--;
+      small[ns++] = g;
+    }
+  }
+  // leftovers are 1 up to rounding
+  while (nl > 0)
+    sim -> aliasprob[large[--nl]] = 1.0;
+  while (ns > 0)
+    sim -> aliasprob[small[--ns]] = 1.0;
+  free(small);
+  free(large);
+  sim -> aliasdirty = 0;
+}
+
+/* splitmix64: next value of a splitmix64 stream */
+static unsigned long long splitmix64(unsigned long long * state)
+{
+  unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
 static void report(Simulation * sim) 
 {
   int i;
@@ -346,7 +1757,7 @@ static void report(Simulation * sim)
   for (i = 0; i < sim -> size * sim -> size; ++i) 
     items[sim -> grid[i].item]++;
 
-  int mostfrequent = maxidx_int(items, sim -> nitems);
+  int mostfrequent = torus_maxidx_int(items, sim -> nitems);
   if (sim -> mostfrequent != mostfrequent) {
     sim -> nchanges++;
     sim -> mostfrequent = mostfrequent;
@@ -354,6 +1765,7 @@ static void report(Simulation * sim)
 
   float homogeneity = (float) items[mostfrequent] / ((float) sim -> size * sim -> size);
   sim -> tothomog += homogeneity;
+  metrics_publish(sim -> metrics, sim -> currentstep, sim -> mostfrequent, homogeneity, sim -> numastat.seconds);
 
   // write short report
   fprintf(sim -> shortreportFP,
@@ -363,7 +1775,29 @@ static void report(Simulation * sim)
 	  homogeneity);
   for (i = 0; i < sim -> nitems; ++i) 
     fprintf(sim -> shortreportFP,"\t%d",items[i]);
+  if (SPATIALREPORT) {
+    int n = sim -> size * sim -> size;
+    int * labels = (int *) malloc(n * sizeof(int));
+    float * values = (float *) malloc(n * sizeof(float));
+    assert(labels && values);
+    for (i = 0; i < n; ++i) {
+      labels[i] = sim -> grid[i].item;
+      values[i] = (sim -> grid[i].item == mostfrequent) ? 1.0 : 0.0;
+    }
+    SpatialStats stats;
+    spatialstats(labels, values, sim -> size, sim -> nitems, &stats);
+    spatialstats_fprint(sim -> shortreportFP, &stats);
+    free(labels);
+    free(values);
+  }
   fprintf(sim -> shortreportFP,"\n");
+  if (sim -> seriesitems) {
+    int row = sim -> currentstep;
+    for (i = 0; i < sim -> nitems; ++i)
+      sim -> seriesitems[row * sim -> nitems + i] = items[i];
+    sim -> seriesmostfrequent[row] = sim -> mostfrequent;
+    sim -> serieshomog[row] = homogeneity;
+  }
 
   // write long report
   if (LONGREPORT) {
@@ -372,12 +1806,28 @@ static void report(Simulation * sim)
 	      "%d %d %d ",
 	      sim -> grid[i].status,
 	      sim -> grid[i].item,
-	      sim -> grid[i].age
+	      agentage(sim, i)
 	      );
     fprintf(sim -> longreportFP,"\n");
   }
 }
 
+/* reportevents: log the pending agents whose item or status changes */
+static void reportevents(Simulation * sim, int npending)
+{
+  int k;
+  for (k = 0; k < npending; ++k) {
+    int i = sim -> pendidx[k];
+    Agent * a = &sim -> pending[k];
+    if (a -> item != sim -> grid[i].item || a -> status != sim -> grid[i].status) {
+      unsigned int oldfields[2] = {sim -> grid[i].item, sim -> grid[i].status};
+      unsigned int newfields[2] = {a -> item, a -> status};
+      eventlog_change(sim -> eventlog, i, oldfields, newfields);
+    }
+  }
+  eventlog_endstep(sim -> eventlog);
+}
+
 static void reportfinal(Simulation * sim)
 {
   fprintf(sim -> finalreportFP, "0. Simulation summary:\n");
@@ -419,6 +1869,28 @@ static void reportfinal(Simulation * sim)
   fprintf(sim -> finalreportFP, "12. Norm impact:\t%.2f\n", sim -> normimpact);
   fprintf(sim -> finalreportFP, "13. Number of changes:\t%d\n", sim -> nchanges);
   fprintf(sim -> finalreportFP, "14. Average homogeneity:\t%.3f\n",(sim -> tothomog / ((float) sim -> nsteps)));
+  if (sim -> nsamples) {
+    fprintf(sim -> finalreportFP, "15. Impact samples:\t%d\n",sim -> nsamples);
+    fprintf(sim -> finalreportFP, "16. Mean relative s.e. of top impact:\t%.4f\n",
+	    (sim -> nestimates) ? sim -> sesum / sim -> nestimates : 0.0);
+    fprintf(sim -> finalreportFP, "17. Exact argmax agreement:\t%.4f\n",
+	    (sim -> nchecked) ? (double) sim -> nagree / sim -> nchecked : 1.0);
+    fprintf(sim -> finalreportFP, "18. Agents checked:\t%ld\n",sim -> nchecked);
+  } else if (sim -> qtnodes) {
+    fprintf(sim -> finalreportFP, "15. Quadtree opening ratio:\t%.2f\n",(float) QUADTREE);
+    fprintf(sim -> finalreportFP, "16. Mean nodes visited:\t%.1f\n",
+	    (sim -> nestimates) ? (double) sim -> qtvisits / sim -> nestimates : 0.0);
+    fprintf(sim -> finalreportFP, "17. Exact argmax agreement:\t%.4f\n",
+	    (sim -> nchecked) ? (double) sim -> nagree / sim -> nchecked : 1.0);
+    fprintf(sim -> finalreportFP, "18. Agents checked:\t%ld\n",sim -> nchecked);
+  } else if (sim -> coarse) {
+    fprintf(sim -> finalreportFP, "15. Coarse block side:\t%d\n",sim -> size / sim -> coarse -> size);
+    fprintf(sim -> finalreportFP, "16. Windows refined:\t%d of %d\n",sim -> nrefined,sim -> nwindows);
+    fprintf(sim -> finalreportFP, "17. Coarse-fine regime agreement:\t%.4f\n",
+	    (sim -> nrefined) ? (double) sim -> nregimeagree / sim -> nrefined : 1.0);
+    fprintf(sim -> finalreportFP, "18. Steps at full resolution:\t%d\n",sim -> nfinesteps);
+  } else if (sim -> fxkernel)
+    fprintf(sim -> finalreportFP, "15. Fixed-point impact fraction bits:\t%d\n",sim -> fxshift);
 }
   
   
@@ -426,20 +1898,135 @@ static void reportfinal(Simulation * sim)
 /* helpers */
 static void end_sim(Simulation * sim)
 {
-  reportfinal(sim);
-  fclose(sim -> shortreportFP);
-  if (LONGREPORT)
-    fclose(sim -> longreportFP);
-  fclose(sim -> finalreportFP);
-  free(sim -> grid);
-  free(sim);
+  run_end(sim);
+  free_sim(sim);
 }
 
-static float rand01() 
+/* set_itempath: nitems wide impact buffers for the dense item path, or
+   the scratch of the sparse one */
+static void set_itempath(Simulation * sim, int sparse)
 {
-  return (float) rand() / ((float) RAND_MAX + 1);
+  int nitems = sim -> nitems;
+  sim -> sparse = sparse;
+  free(sim -> impactbuf);
+  free(sim -> itemcounts);
+  free(sim -> itemimpacts);
+  free(sim -> cummass);
+  free(sim -> touched);
+  sim -> impactbuf = (float *) malloc(IMPACT_CHUNK * (sparse ? 1 : nitems) * sizeof(float));
+  assert(sim -> impactbuf);
+  if (sparse) {
+    sim -> itemcounts = (int *) calloc(nitems, sizeof(int));
+    sim -> itemimpacts = (float *) malloc(nitems * sizeof(float));
+    sim -> cummass = (float *) malloc((nitems + 1) * sizeof(float));
+    sim -> touched = (int *) malloc(nitems * sizeof(int));
+    assert(sim -> itemcounts && sim -> itemimpacts && sim -> cummass && sim -> touched);
+  } else {
+    sim -> itemcounts = NULL;
+    sim -> itemimpacts = NULL;
+    sim -> cummass = NULL;
+    sim -> touched = NULL;
+  }
 }
 
+/*
+ * autotune: choose the item path by timing both on agents of the actual
+ * grid: the dense one collects nitems wide impacts in parallel, the
+ * sparse one touches only the items present but runs in index order.
+ * Their results are the same, so the faster one wins; the choice goes to
+ * the tuning cache, see simcore/tune.h. Sampled impacts need the dense
+ * path and the reference build does not tune.
+ */
+static void autotune(Simulation * sim)
+{
+  if (REFERENCE || sim -> nsamples || sim -> qtnodes || sim -> nitems > TUNE_MAXDENSE)
+    return;
+  // the dense path's cost depends on its kernel
+  char kernel[16], shape[TUNE_KEY_SIZE], key[TUNE_KEY_SIZE];
+  if (sim -> fxkernel)
+    snprintf(kernel, sizeof(kernel), "fixed%d", sim -> simd);
+  else if (sim -> simd >= 0)
+    snprintf(kernel, sizeof(kernel), "simd%d", sim -> simd);
+  else
+    snprintf(kernel, sizeof(kernel), "scalar");
+  snprintf(shape, sizeof(shape), "socimpact size %d nitems %d maxage %d dense %s",
+	   sim -> size, sim -> nitems, sim -> maxage, kernel);
+  tune_key(key, sizeof(key), shape);
+  int params[1];
+  if (tune_lookup(key, params, 1)) {
+    set_itempath(sim, params[0]);
+    printf("Autotune:	%s item path (cached)\n", (sim -> sparse) ? "sparse" : "dense");
+    return;
+  }
+  int n = sim -> size * sim -> size;
+  int threads = 1;
+#ifdef _OPENMP
+  threads = omp_get_max_threads();
+#endif
+  int nsample = min(n, min(IMPACT_CHUNK, TUNE_SAMPLE * threads));
+  int k;
+  set_itempath(sim, 0);
+  if (sim -> simd >= 0)
+    sources_simd(sim);
+  double t0 = tune_clock();
+#pragma omp parallel for schedule(dynamic, 16)
+  for (k = 0; k < nsample; ++k)
+    collectimpacts(sim, (long) k * n / nsample, sim -> impactbuf + k * sim -> nitems);
+  double dense = tune_clock() - t0;
+  set_itempath(sim, 1);
+  t0 = tune_clock();
+  for (k = 0; k < nsample; ++k)
+    collectimpacts_sparse(sim, (long) k * n / nsample);
+  double sparse = tune_clock() - t0;
+  set_itempath(sim, sparse < dense);
+  // ages 1 and 2 collect impacts
+  double young = 2.0 * n / sim -> maxage;
+  params[0] = sim -> sparse;
+  tune_store(key, min(dense, sparse) / nsample * young, params, 1);
+  printf("Autotune:\t%s item path, %.3g s dense, %.3g s sparse per %d agents\n",
+	 (sim -> sparse) ? "sparse" : "dense", dense, sparse, nsample);
+}
+
+void free_sim(Simulation * sim)
+{
+  int n = sim -> size * sim -> size;
+  metrics_close(sim -> metrics);
+  free(sim -> seriesitems);
+  free(sim -> seriesmostfrequent);
+  free(sim -> serieshomog);
+  free(sim -> windowitems);
+  if (sim -> coarse)
+    free_sim(sim -> coarse);
+  free(sim -> aliasprob);
+  free(sim -> alias);
+  free(sim -> eligible);
+  free(sim -> sebuf);
+  free(sim -> srcitem);
+  free(sim -> srcstatus);
+  free(sim -> srccount);
+  numa_free(sim -> dist2, 2 * n * sizeof(float));
+  free(sim -> fxstatus);
+  numa_free(sim -> fxkernel, 2 * n * sizeof(unsigned int));
+  free(sim -> qtnodes);
+  free(sim -> qtleaf);
+  free(sim -> qtcount);
+  free(sim -> qtstatus);
+  numa_free(sim -> qtkernel, (2 * sim -> size + 1) * (2 * sim -> size + 1) * sizeof(double));
+  free(sim -> itemcounts);
+  free(sim -> itemimpacts);
+  free(sim -> cummass);
+  free(sim -> touched);
+  free(sim -> cohortstart);
+  free(sim -> impactbuf);
+  numa_free(sim -> cohorts, n * sizeof(int));
+  numa_free(sim -> pendidx, n * sizeof(int));
+  numa_free(sim -> pending, n * sizeof(Agent));
+  if (sim -> snapshot)
+    snapshot_close(sim -> snapshot);
+  else
+    numa_free(sim -> grid, n * sizeof(Agent));
+  free(sim);
+}
 
 static char * makefilename(Simulation * sim, char * path, char * type)
 {
@@ -462,23 +2049,3 @@ static char * makefilename(Simulation * sim, char * path, char * type)
 	  );
   return buffer;
 }
-
-/* distance: calculate euclidean distance from array indices */
-static float distance(int pos1, int pos2, int size) 
-{
-  int x1 = pos1 / size;
-  int y1 = pos1 % size;
-  int x2 = pos2 / size;
-  int y2 = pos2 % size;
-
-  int xdiff = fabs(x1 - x2);
-  int ydiff = fabs(y1 - y2);
-  
-  xdiff = min(xdiff, fabs(size - xdiff));
-  ydiff = min(ydiff, fabs(size - ydiff));
-
-  return sqrt(xdiff*xdiff + ydiff*ydiff);
-}
-
-
-    
@@ -6,14 +6,31 @@
 #ifndef _SOCIMPACTFUNCS_H
 #define _SOCIMPACTFUNCS_H
 
+#include "eventlog.h"
+#include "numa.h"
+#include "rng.h"
+#include "snapshot.h"
+#include "metrics.h"
+
+/* quadtree node: a block of rows x0.. and columns y0.. */
+typedef struct {
+  int x0, y0, w, h;
+  int child; /* first of nchild children, -1: a single agent */
+  int nchild;
+  int parent;
+  int slot; /* of its counts and status sums, -1: a leaf, read from the grid */
+} QtNode;
+
+/* an agent's age is (phase + ageclock) % maxage + 1 */
 typedef struct {
   int item;
   int status;
-  int age;
+  int phase;
 } Agent;
 
-typedef struct {
+typedef struct Simulation {
   Agent * grid;
+  Snapshot * snapshot; /* the grid's file with INITSNAPSHOT, else NULL */
   int size;
   int seed;
   int maxage;
@@ -28,11 +45,70 @@ typedef struct {
   FILE * shortreportFP;
   FILE * longreportFP;
   FILE * finalreportFP;
+  EventLog * eventlog;
+  Metrics * metrics; /* live metrics with LIVEMETRICS, else NULL */
   int nsteps;
   int currentstep;
+  int ageclock; /* steps applied to the grid */
+  int * cohortstart; /* cohorts[cohortstart[p]..cohortstart[p+1]) has phase p */
+  int * cohorts;
+  int * pendidx; /* agents updated in the current step */
+  Agent * pending;
+  float * impactbuf; /* impacts of a chunk of young agents */
+  NumaStat numastat;
+  Rng rng;
   int mostfrequent;
   int nchanges;
   float tothomog;
+  int sparse; /* item path, see set_itempath() */
+  /* large-vocabulary scratch, only allocated for the sparse item path */
+  int * itemcounts;
+  float * itemimpacts;
+  float * cummass;
+  int * touched;
+  /* importance-sampled impacts, see set_samples() */
+  int nsamples; /* sources per young agent, 0: exact */
+  double * aliasprob; /* alias table over status */
+  int * alias;
+  double statustotal;
+  int aliasdirty; /* a rebirth changed a status */
+  int * eligible; /* agents older than 1 per item */
+  float * sebuf; /* relative standard errors of a chunk */
+  double sesum;
+  long nestimates;
+  long nchecked; /* young agents compared against the exact sums */
+  long nagree;
+  /* vectorized exact impacts for small vocabularies, see sources_simd() */
+  int simd; /* SIMD_SCALAR, SIMD_AVX2 or SIMD_AVX512, -1: off */
+  int * srcitem; /* item of every source, -1: age 1 */
+  float * srcstatus;
+  int * srccount; /* sources per item */
+  float * dist2; /* squared distances by row offset, then column offset + size */
+  /* fixed-point exact impacts, see collectimpacts_fixed() */
+  unsigned int * fxstatus; /* status of every source */
+  unsigned int * fxkernel; /* 2^fxshift / d^2 rounded, laid out as dist2 */
+  int fxshift;
+  /* quadtree impacts, see collectimpacts_qt() */
+  QtNode * qtnodes; /* root first, NULL: off */
+  int nqtnodes;
+  int * qtleaf; /* node of every agent */
+  int nqtslots; /* internal nodes */
+  int * qtcount; /* agents per internal node, item and birth phase */
+  double * qtstatus; /* their status sum */
+  double * qtkernel; /* prefix sums of 1 / d^2 over twice the torus */
+  long qtvisits;
+  /* the short report in memory, see set_series() */
+  int * seriesitems; /* item counts, nitems per row */
+  int * seriesmostfrequent;
+  float * serieshomog;
+  /* coarse-to-fine runs, see multigrid() */
+  struct Simulation * coarse; /* the block-aggregated run, NULL: off */
+  int * windowitems; /* coarse: the items of every step of the window */
+  int windowstart;
+  int nwindows;
+  int nrefined;
+  int nfinesteps;
+  int nregimeagree; /* of the refined windows */
 } Simulation;
 
 Simulation * init_sim(int size,
@@ -49,6 +125,13 @@ Simulation * init_sim(int size,
 		      float normimpact,
 		      char * path
 		      );
+void set_samples(Simulation *, int);
+void set_series(Simulation *);
 void run(Simulation *);
+void run_begin(Simulation *);
+int run_steps(Simulation *, int);
+void run_end(Simulation *);
+void free_sim(Simulation *);
+void run_branches(Simulation *, int, int, float *, float *, char *);
 
 #endif /* _SOCIMPACTFUNCS_H */
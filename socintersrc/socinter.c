@@ -12,7 +12,7 @@
 
 int main(int argc, char * argv[])
 {
-  if (argc != 14) {
+  if (argc < 14 || argc > 17) {
     printf("\nsocinter: Simulation of linguistic change through social interaction.\nUsage:\n");
     printf("\t1. output path\n");
     printf("\t2. size of grid (20)\n");
@@ -26,7 +26,10 @@ int main(int argc, char * argv[])
     printf("\t10. age distribution (0: cohorts 1: random)\n");
     printf("\t11. status distribution (0: uniform 1: normal)\n");
     printf("\t12. itemdistr (0: same for all 1: uniform 2: bimodal)\n");
-    printf("\t13. markpercentile [0.0..1.0]\n\n");
+    printf("\t13. markpercentile [0.0..1.0]\n");
+    printf("\t14. engine (optional, 0: exact 1: fft 2: incremental 3: tiled -1: fastest)\n");
+    printf("\t15. tolerance (optional, relative utility error at checks, %g)\n",ENGINE_TOLERANCE);
+    printf("\t16. radius (optional, tiled engine: interactions up to this distance, %d)\n\n",TILED_RADIUS);
   } else {
     int size = atoi(argv[2]);
     int nsteps = atoi(argv[3]);
@@ -41,6 +44,9 @@ int main(int argc, char * argv[])
     int itdistr = atoi(argv[12]);
     float markp = atof(argv[13]);
     char * path = argv[1];
+    int engine = (argc > 14) ? atoi(argv[14]) : ENGINE_EXACT;
+    float tolerance = (argc > 15) ? atof(argv[15]) : ENGINE_TOLERANCE;
+    int radius = (argc > 16) ? atoi(argv[16]) : TILED_RADIUS;
 
     printf("\nSimulation of linguistic change through social interaction.\n");
     printf("\tSize:\t\t\t%d by %d\n",size,size);
@@ -53,6 +59,25 @@ int main(int argc, char * argv[])
     printf("\tDeviation factor:\t%.3f\n",dev);
     printf("\tDrift factor:\t\t%.3f\n",drift);
     printf("\tMark percentile:\t%.3f\n",markp);
+    char * engstring;
+    switch(engine) {
+    case ENGINE_FFT:
+      engstring = "FFT";
+      break;
+    case ENGINE_INCR:
+      engstring = "INCREMENTAL";
+      break;
+    case ENGINE_TILED:
+      engstring = "TILED";
+      break;
+    case ENGINE_AUTO:
+      engstring = "AUTO";
+      break;
+    default:
+      engstring = "EXACT";
+      break;
+    }
+    printf("\tEngine:\t\t\t%s\n",engstring);
     printf("\nInitial settings:\n");
     printf("\tAge distribution:\t%s\n",(agedistr) ? "COHORT" : "RANDOM");
     char * itstring;
@@ -87,7 +112,9 @@ int main(int argc, char * argv[])
 				markp,
 				path
 				);
-				
+    set_radius(sim, radius);
+    set_engine(sim, engine, tolerance);
+
     run(sim);
   }
   return 0;
@@ -1,9 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <string.h>
 #include <math.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "socinterfuncs.h"
+#include "spatial.h"
+#include "numa.h"
+#include "tune.h"
+#include "torus.h"
+#include "metrics.h"
 
 #ifndef max
 #define max(a , b) ( ((a) > (b)) ? (a) : (b) )
@@ -16,6 +26,14 @@
 #define DEBUG 0
 #define LONGREPORT 0
 
+#ifndef EVENTREPORT
+#define EVENTREPORT 0 /* binary change log, see simcore/eventlog.h */
+#endif
+
+#ifndef SPATIALREPORT
+#define SPATIALREPORT 0 /* append cluster, join count and radial columns */
+#endif
+
 #define NDEBUG
 #include <assert.h>
 
@@ -27,6 +45,36 @@
 #define VPRINT(e) printf((DEBUG) ? ("DEBUG " #e ":\t%g\n", e) : "")
 #endif
 
+#ifndef REFERENCE
+#define REFERENCE 0 /* frozen reference engine: serial exact sums, see simcore/socdiff */
+#endif
+
+#ifndef OUTOFCORE
+#define OUTOFCORE 0 /* grid and cohorts in memory-mapped tiles, tiled engine only */
+#endif
+
+#if OUTOFCORE && REFERENCE
+#error "the reference engine keeps the grid in memory"
+#endif
+
+#define ENGINECHECK 100 /* fft engine: exact check every so many steps, 0: never */
+#define FFT_BINS 8 /* initial conformity nodes per dimension */
+#define FFT_MAXBINS 32
+#define PAIR_ROWS 64 /* exact engine: agents per block of the tiled pair sweep */
+
+#ifndef AUTOTUNE
+#define AUTOTUNE 0 /* time the exact pair tiles at startup, see autotune() */
+#endif
+#define TUNE_ROWS 256 /* autotune: agents whose sums are timed */
+#define TUNE_NTILES 5
+#define TUNE_REBIRTHS 16 /* autotune: incremental rebirth passes timed */
+
+/* decisions keyed with RNG_CRN, see rng_keyed() */
+#define CRN_STATUS 0
+#define CRN_AGE 1
+#define CRN_ITEM 2
+#define CRN_DRIFT 3
+
 #define NAME_BUF_SIZE 300
 #define HYPER_THRESH 0.025
 
@@ -34,14 +82,37 @@
 static void step(Simulation *);
 static void report(Simulation *);
 static void reportfinal(Simulation *);
+static void reportevent(Simulation *, int, float);
+static int agentage(Simulation *, int);
+static void agentfields(Agent *, unsigned int *);
 static void end_sim(Simulation *);
-static int maxidx(int *, int);
 static void sim_free(Simulation *);
-static float rand01(void);
 static char * makefilename(Simulation *, char *, char *);
-static float distance(int, int, int);
 static float convert(float, float, float, float, float);
 static int cmp_stat(const void *, const void *);
+static float conformity(Simulation *, float, float);
+static void utgains_exact(Simulation *, float *, float *);
+static void utgains_fft(Simulation *, float *, float *);
+static void checkengine(Simulation *, float *, float *);
+static void utgains_incr(Simulation *, float, float *);
+static void incr_setup(Simulation *);
+static void incr_release(Simulation *);
+static void incr_build(Simulation *);
+static void incr_rebirth(Simulation *, int, float);
+static float kernelat(Simulation *, int, int);
+static void itemstats(Simulation *, float *, float *, float *);
+static void utgains_rows(Simulation *, float *, float *, int, int);
+static void fft_setup(Simulation *);
+static void fft_release(Simulation *);
+static int autotune(Simulation *, int, float);
+static void rebirth(Simulation *, int, float *);
+static void step_tiled(Simulation *);
+static void gains_tile(Simulation *, int, float);
+static void rebirth_tile(Simulation *, int, int, float *);
+static int cohortfrom(Simulation *, int, int);
+static void set_marks(Simulation *);
+static float statusrank(Simulation *, int, int *);
+static void streammarks(Simulation *, int *, float *);
 
 
 /* functions */
@@ -71,6 +142,7 @@ Simulation * init_sim(
   sim -> nsteps = nsteps;
   sim -> seed = seed;
   sim -> currentstep = 0;
+  sim -> ageclock = 0;
 
   // initialize simulation parameters
   sim -> distpower = distpower;
@@ -84,17 +156,38 @@ Simulation * init_sim(
   sim -> statusdistr = statusdistr;
   sim -> itemdistr = itemdistr;
   sim -> markpercentile = markpercentile;
+
+  // exact utility engine unless set_engine() says otherwise
+  sim -> engine = ENGINE_EXACT;
+  sim -> tolerance = 0.0;
+  sim -> nbins = 0;
+  sim -> conv = NULL;
+  sim -> convbuf = NULL;
+  sim -> nodecell = NULL;
+  sim -> nodeweight = NULL;
+  sim -> maxerror = 0.0;
+  sim -> nchecks = 0;
+  sim -> kernel = NULL;
+  sim -> confsum = NULL;
+  sim -> itemsum = NULL;
+  sim -> incrbuf = NULL;
+  sim -> pairtile = 0;
+  sim -> radius = TILED_RADIUS;
+  sim -> nstencil = 0;
+  sim -> stencilx = NULL;
+  sim -> stencily = NULL;
+  sim -> stencilw = NULL;
+  sim -> marksclock = -1;
   
   // initialize file pointers
   char * shortreport = makefilename(sim, reportpath, "short");
-  sim -> shortreportFP = fopen(shortreport,"w");
-  assert(sim -> shortreportFP);
+  sim -> shortreportFP = torus_openreport(shortreport, "w");
+  sim -> metrics = LIVEMETRICS ? metrics_open(MODEL_SOCINTER, nsteps, shortreport) : NULL;
   free(shortreport);
   
   if (LONGREPORT) {
     char * longreport = makefilename(sim, reportpath, "long");
-    sim -> longreportFP = fopen(longreport, "w");
-    assert(sim -> longreportFP);
+    sim -> longreportFP = torus_openreport(longreport, "w");
     free(longreport);
   } else {
     sim -> longreportFP = NULL;
@@ -102,15 +195,40 @@ Simulation * init_sim(
   
 
   char * finalreport = makefilename(sim, reportpath, "final");
-  sim -> finalreportFP = fopen(finalreport,"w");
-  assert(sim -> finalreportFP);
+  sim -> finalreportFP = torus_openreport(finalreport, "w");
   free(finalreport);
 
-  sim -> grid = malloc(size*size*sizeof(Agent));
-  assert(sim -> grid);
+  // pin the threads before their first touch places the buffers
+#ifdef _OPENMP
+  if (REFERENCE)
+    omp_set_num_threads(1);
+#endif
+  numa_pin(PINTHREADS);
+  numa_snapshot(&sim -> numastat);
+  sim -> tilerows = tiles_rows(size, size * sizeof(Agent));
+  if (OUTOFCORE) {
+    // the tiled engine needs no full-size scratch buffers
+    char * tiles = makefilename(sim, reportpath, "tiles");
+    sim -> gridtiles = tiles_open(tiles, size * size * sizeof(Agent), sim -> tilerows * size * sizeof(Agent));
+    free(tiles);
+    char * cohorts = makefilename(sim, reportpath, "cohorts");
+    sim -> cohorttiles = tiles_open(cohorts, size * size * sizeof(int), 0);
+    free(cohorts);
+    sim -> grid = (Agent *) sim -> gridtiles -> base;
+    sim -> sortedgrid = NULL;
+    sim -> itstats = NULL;
+    sim -> utgains = NULL;
+  } else {
+    sim -> gridtiles = NULL;
+    sim -> cohorttiles = NULL;
+    sim -> grid = (Agent *) numa_alloc(size * size * sizeof(Agent));
+    sim -> sortedgrid = (Agent *) numa_alloc(size * size * sizeof(Agent));
+    sim -> itstats = (float *) numa_alloc(size * size * sizeof(float));
+    sim -> utgains = (float *) numa_alloc(size * size * sizeof(float));
+  }
 
-  // initialize rand sequence
-  srand(seed);
+  // initialize the random stream, see simcore/rng.h
+  rng_seed(&sim -> rng, RNG_MODE, seed);
 
   // initialize population grid
   int i;
@@ -119,10 +237,11 @@ Simulation * init_sim(
     int xpos = i / size;
     // determine status
     float status;
+    rng_keyed(&sim -> rng, seed, i, 0, CRN_STATUS);
     if (statusdistr) 
-      status = pow(rand01() * size, 2.0) / (size*size);
+      status = pow(rng_float(&sim -> rng) * size, 2.0) / (size*size);
     else
-      status = rand01();
+      status = rng_float(&sim -> rng);
     // determine age
     int age;
     if (agedistr) {
@@ -131,8 +250,10 @@ Simulation * init_sim(
       else
 	age = maxage - (xpos % maxage);
     }
-    else
-      age = (int) (rand01() * maxage);
+    else {
+      rng_keyed(&sim -> rng, seed, i, 0, CRN_AGE);
+      age = (int) (rng_float(&sim -> rng) * maxage);
+    }
     // determine starting item
     float item = 0.5;
     switch(itemdistr) {
@@ -140,46 +261,363 @@ Simulation * init_sim(
       item = 0.5;
       break;
     case 1:
-      item = rand01();
+      rng_keyed(&sim -> rng, seed, i, 0, CRN_ITEM);
+      item = rng_float(&sim -> rng);
       break;
     case 2:
       item = (status > 0.5) ? 0.75 : 0.25;
       break;
     }
     float utility = 0.0;
-    Agent a = {status, item, age, utility};
+    Agent a = {status, item, age, utility}; // birth phase is the initial age
     sim -> grid[i] = a;
   }
 
+  // cohorts: agent indices by birth phase, in index order
+  sim -> cohortstart = (int *) calloc(maxage + 2, sizeof(int));
+  if (OUTOFCORE)
+    sim -> cohorts = (int *) sim -> cohorttiles -> base;
+  else
+    sim -> cohorts = (int *) numa_alloc(size * size * sizeof(int));
+  assert(sim -> cohortstart && sim -> cohorts);
+  for (i = 0; i < size * size; ++i)
+    sim -> cohortstart[sim -> grid[i].phase + 1]++;
+  for (i = 0; i <= maxage; ++i)
+    sim -> cohortstart[i + 1] += sim -> cohortstart[i];
+  int fill[maxage + 1];
+  for (i = 0; i <= maxage; ++i)
+    fill[i] = sim -> cohortstart[i];
+  for (i = 0; i < size * size; ++i)
+    sim -> cohorts[fill[sim -> grid[i].phase]++] = i;
+
+  // log the initial grid
+  if (EVENTREPORT) {
+    char * events = makefilename(sim, reportpath, "events");
+    char types[2] = {'f', 'f'};
+    sim -> eventlog = eventlog_open(events, MODEL_SOCINTER, size, maxage, 0, 2, types);
+    free(events);
+    for (i = 0; i < size * size; ++i) {
+      unsigned int fields[2];
+      agentfields(&sim -> grid[i], fields);
+      eventlog_agent(sim -> eventlog, agentage(sim, i), fields);
+    }
+  } else
+    sim -> eventlog = NULL;
+
   return sim;
 }
 
+/* set_engine: select the utility engine, tolerance is the relative
+   utility error the fft or incremental engine may show at check steps */
+void set_engine(Simulation * sim, int engine, float tolerance)
+{
+  if (REFERENCE)
+    engine = ENGINE_EXACT;
+  if (OUTOFCORE)
+    engine = ENGINE_TILED;
+  if (engine == ENGINE_AUTO || (AUTOTUNE && !REFERENCE && engine == ENGINE_EXACT))
+    engine = autotune(sim, engine, tolerance);
+  sim -> engine = engine;
+  sim -> tolerance = tolerance;
+  if (engine == ENGINE_TILED && !sim -> stencilx) {
+    // offsets within the radius on the torus, each neighbour once
+    int size = sim -> size;
+    int reach = min(sim -> radius, size / 2);
+    int side = 2 * reach + 1;
+    sim -> stencilx = (int *) malloc(side * side * sizeof(int));
+    sim -> stencily = (int *) malloc(side * side * sizeof(int));
+    sim -> stencilw = (float *) malloc(side * side * sizeof(float));
+    assert(sim -> stencilx && sim -> stencily && sim -> stencilw);
+    int dx, dy;
+    for (dx = -reach; dx <= reach; ++dx)
+      for (dy = -reach; dy <= reach; ++dy) {
+	if ((dx == 0 && dy == 0) || (2 * reach == size && (dx == -reach || dy == -reach)))
+	  continue;
+	int ox = (dx + size) % size;
+	int oy = (dy + size) % size;
+	float eucldist = torus_distance(0, ox * size + oy, size);
+	if (eucldist > sim -> radius)
+	  continue;
+	sim -> stencilx[sim -> nstencil] = ox;
+	sim -> stencily[sim -> nstencil] = oy;
+	sim -> stencilw[sim -> nstencil] = 1.0 / pow(eucldist, (float) sim -> distpower);
+	sim -> nstencil++;
+      }
+    set_marks(sim);
+  }
+  if (engine == ENGINE_INCR && !sim -> kernel) {
+    incr_setup(sim);
+    incr_build(sim);
+  }
+  if (engine == ENGINE_FFT && !sim -> conv)
+    fft_setup(sim);
+}
+
+/* fft_setup: transform of the kernel and the node buffers */
+static void fft_setup(Simulation * sim)
+{
+  // kernel 1 / d^p over all displacements, 0 for the agent itself
+  int size = sim -> size;
+  int n = size * size;
+  double * kernel = (double *) malloc(n * sizeof(double));
+  assert(kernel);
+  sim -> ktotal = 0.0;
+  int i;
+  for (i = 1; i < n; ++i) {
+    float eucldist = torus_distance(0, i, size);
+    kernel[i] = 1.0 / pow(eucldist, (float) sim -> distpower);
+    sim -> ktotal += kernel[i];
+  }
+  kernel[0] = 0.0;
+  sim -> conv = torusconv_new(size, kernel);
+  free(kernel);
+
+  sim -> nbins = FFT_BINS;
+  sim -> convbuf = (double *) malloc(6 * n * sizeof(double));
+  sim -> nodecell = (int *) malloc(n * sizeof(int));
+  sim -> nodeweight = (float *) malloc(2 * n * sizeof(float));
+  assert(sim -> convbuf && sim -> nodecell && sim -> nodeweight);
+}
+
+static void fft_release(Simulation * sim)
+{
+  torusconv_free(sim -> conv);
+  free(sim -> convbuf);
+  free(sim -> nodecell);
+  free(sim -> nodeweight);
+  sim -> conv = NULL;
+  sim -> convbuf = NULL;
+  sim -> nodecell = NULL;
+  sim -> nodeweight = NULL;
+  sim -> nbins = 0;
+}
+
+/*
+ * autotune: time the candidates on agents of the actual grid and keep
+ * the fastest per step. The exact sums are timed untiled and with pair
+ * tiles; a tiling only competes if its sums on the timed agents are bit
+ * for bit those of the untiled sweep. With ENGINE_AUTO the fft engine, at
+ * the fewest conformity nodes whose error on the timed agents is within
+ * tolerance, and the incremental engine compete as well; both pay for an
+ * exact check every ENGINECHECK steps. The incremental step is timed as
+ * a build spread over the run plus, per reborn agent, a timed rebirth
+ * pass; the sums of the build are kept if it wins. The choice goes to
+ * the tuning cache, see simcore/tune.h.
+ */
+static int autotune(Simulation * sim, int engine, float tolerance)
+{
+  int n = sim -> size * sim -> size;
+  char shape[TUNE_KEY_SIZE], key[TUNE_KEY_SIZE];
+  snprintf(shape, sizeof(shape), "socinter %s size %d steps %d maxage %d dist %d dev %.3f tol %.4f",
+	   (engine == ENGINE_AUTO) ? "auto" : "exact", sim -> size, sim -> nsteps, sim -> maxage,
+	   sim -> distpower, sim -> deviationfactor, tolerance);
+  tune_key(key, sizeof(key), shape);
+  int params[3];
+  if (tune_lookup(key, params, 3)) {
+    sim -> pairtile = params[1];
+    if (params[0] == ENGINE_FFT) {
+      fft_setup(sim);
+      sim -> nbins = params[2];
+    }
+    printf("Autotune:\tengine %d, pair tile %d (cached)\n", params[0], params[1]);
+    return params[0];
+  }
+  int threads = 1;
+#ifdef _OPENMP
+  threads = omp_get_max_threads();
+#endif
+  int rows = min(n, max(TUNE_ROWS, 2 * PAIR_ROWS * threads));
+  float lowmark, highmark;
+  float * itstats = sim -> itstats;
+  itemstats(sim, itstats, &lowmark, &highmark);
+  float * exact = (float *) malloc(n * sizeof(float));
+  float * out = (float *) malloc(n * sizeof(float));
+  assert(exact && out);
+
+  // exact sums; single threaded and untiled is the triangular sweep,
+  // which visits every pair once
+  int tiles[TUNE_NTILES] = {0, 256, 1024, 4096, 16384};
+  double texact = INFINITY;
+  int k;
+  for (k = 0; k < TUNE_NTILES && tiles[k] < n; ++k) {
+    sim -> pairtile = tiles[k];
+    double t0 = tune_clock();
+    utgains_rows(sim, itstats, tiles[k] ? out : exact, 0, rows);
+    double t = (tune_clock() - t0) / rows * n;
+    if (!tiles[k] && threads == 1)
+      t /= 2;
+    if (tiles[k] && memcmp(out, exact, rows * sizeof(float)))
+      continue;
+    if (t < texact) {
+      texact = t;
+      params[1] = tiles[k];
+    }
+  }
+  sim -> pairtile = params[1];
+  int choice = ENGINE_EXACT;
+  double best = texact;
+
+  if (engine == ENGINE_AUTO) {
+    double tcheck = ENGINECHECK ? texact / ENGINECHECK : 0.0;
+    fft_setup(sim);
+    int nb;
+    for (nb = FFT_BINS; nb <= FFT_MAXBINS; nb *= 2) {
+      sim -> nbins = nb;
+      double t0 = tune_clock();
+      utgains_fft(sim, itstats, out);
+      double t = tune_clock() - t0 + tcheck;
+      double maxdiff = 0.0, maxabs = 0.0;
+      int i;
+      for (i = 0; i < rows; ++i) {
+	maxdiff = max(maxdiff, fabs(out[i] - exact[i]));
+	maxabs = max(maxabs, fabs(exact[i]));
+      }
+      float error = (maxabs > 0.0) ? maxdiff / maxabs : maxdiff;
+      if (error <= tolerance) {
+	if (t < best) {
+	  best = t;
+	  choice = ENGINE_FFT;
+	}
+	break;
+      }
+    }
+    // rebirth passes first, on sums the build then overwrites; an item
+    // moved by half its range stands for a rebirth
+    incr_setup(sim);
+    double t0 = tune_clock();
+    for (k = 0; k < TUNE_REBIRTHS; ++k) {
+      int r = (long) k * n / TUNE_REBIRTHS;
+      float item = sim -> grid[r].item;
+      incr_rebirth(sim, r, (item < 0.5) ? item + 0.5 : item - 0.5);
+    }
+    double trebirth = (tune_clock() - t0) / TUNE_REBIRTHS;
+    t0 = tune_clock();
+    incr_build(sim);
+    double tbuild = tune_clock() - t0;
+    double tincr = tbuild / max(1, sim -> nsteps) + (double) n / (sim -> maxage + 1) * trebirth + tcheck;
+    if (tincr < best) {
+      best = tincr;
+      choice = ENGINE_INCR;
+    }
+    if (choice != ENGINE_FFT)
+      fft_release(sim);
+    if (choice != ENGINE_INCR)
+      incr_release(sim);
+  }
+  free(exact);
+  free(out);
+  params[0] = choice;
+  params[2] = sim -> nbins;
+  tune_store(key, best, params, 3);
+  printf("Autotune:\tengine %d, pair tile %d, %.3g s per step, exact %.3g s\n",
+	 choice, sim -> pairtile, best, texact);
+  return choice;
+}
+
+/* set_radius: interaction radius of the tiled engine, call before
+   set_engine() */
+void set_radius(Simulation * sim, int radius)
+{
+  sim -> radius = max(1, radius);
+}
+
 void run(Simulation * sim)
 {
   printf("Starting run...\n");
   
   report(sim);
-  while (sim -> currentstep++ < sim -> nsteps) {
-    step(sim);
-    report(sim);
-  }
+  TorusModel model = {sim,
+		      (void (*)(void *)) step,
+		      (void (*)(void *)) report,
+		      &sim -> currentstep,
+		      &sim -> numastat};
+  torus_advance(&model, sim -> nsteps);
   end_sim(sim);
   printf("Run done.\n");
 }
 
 static void step(Simulation * sim)
 {
+  if (sim -> engine == ENGINE_TILED) {
+    step_tiled(sim);
+    return;
+  }
   int size = sim -> size;
-
-  // two copies, one the new, other sorted
-  Agent * newgrid = (Agent *) malloc(size*size*sizeof(Agent));
-  Agent * sortedgrid = (Agent *) malloc (size * size * sizeof(Agent));
   int i;
-  for (i = 0; i < size * size; ++i) {
-    Agent a = sim -> grid[i];
-    sortedgrid[i] = a;
-    newgrid[i] = a;
+
+  // calculate all item statuses
+  float lowmark, highmark;
+  float * itstats = sim -> itstats;
+  itemstats(sim, itstats, &lowmark, &highmark);
+
+  // calculate all utilitygains
+  float * utgains = sim -> utgains;
+  if (sim -> engine == ENGINE_FFT) {
+    utgains_fft(sim, itstats, utgains);
+    if (ENGINECHECK && (sim -> currentstep - 1) % ENGINECHECK == 0)
+      checkengine(sim, itstats, utgains);
+  } else if (sim -> engine == ENGINE_INCR) {
+    // itstats are affine in the items, only their scale survives the
+    // pairwise difference
+    utgains_incr(sim, (lowmark != highmark) ? 1.0 / (highmark - lowmark) : 0.0, utgains);
+    if (ENGINECHECK && (sim -> currentstep - 1) % ENGINECHECK == 0)
+      checkengine(sim, itstats, utgains);
+  } else
+    utgains_exact(sim, itstats, utgains);
+
+  // update the agents
+  for (i = 0; i < size * size; ++i)
+    sim -> grid[i].utility += utgains[i];
+
+  // rebirth of the cohort that passes maxage, in index order
+  int cycle = sim -> maxage + 1;
+  int phase = ((sim -> maxage - sim -> ageclock) % cycle + cycle) % cycle;
+  int k;
+  for (k = sim -> cohortstart[phase]; k < sim -> cohortstart[phase + 1]; ++k)
+    rebirth(sim, sim -> cohorts[k], NULL);
+  if (EVENTREPORT)
+    eventlog_endstep(sim -> eventlog);
+  sim -> ageclock++;
+}
+
+/* rebirth: agent idx takes a new item, drifted by its utility; with
+   itemout set the item goes there and the grid keeps the old one */
+static void rebirth(Simulation * sim, int idx, float * itemout)
+{
+  Agent * a = &sim -> grid[idx];
+  // determine drift
+  float drift;
+  rng_keyed(&sim -> rng, sim -> seed, idx, sim -> currentstep, CRN_DRIFT);
+  if (a -> utility > 0) {
+    drift = rng_float(&sim -> rng) * 0.02 - 0.01;
+  } else { // drift
+    drift = (rng_float(&sim -> rng)*2.0 -1.0) * sim -> driftfactor * fabs(a -> utility);
+  }
+  float item = min(1.0,max(0.0,drift + a -> item));
+  if (EVENTREPORT)
+    reportevent(sim, idx, item);
+  float olditem = a -> item;
+  a -> utility = 0.0;
+  if (itemout) {
+    *itemout = item;
+    return;
   }
+  a -> item = item;
+  if (sim -> engine == ENGINE_INCR)
+    incr_rebirth(sim, idx, olditem);
+}
+
+/* itemstats: item statuses between the marks, the mean items of the
+   lowest and highest markpercentile agents by status */
+static void itemstats(Simulation * sim, float * itstats, float * lowmarkp, float * highmarkp)
+{
+  int size = sim -> size;
+
+  // sorted copy for the marks, the grid itself is updated in place
+  Agent * sortedgrid = sim -> sortedgrid;
+  int i;
+  for (i = 0; i < size * size; ++i)
+    sortedgrid[i] = sim -> grid[i];
   // sort the grid into sortedgrid
   qsort(sortedgrid, size*size, sizeof(Agent), cmp_stat);
 
@@ -196,23 +634,37 @@ static void step(Simulation * sim)
   for (i = highpercentilemark; i < size * size; ++i)
     itemsum += sortedgrid[i].item;
   float highmark = itemsum / lowpercentilemark;
-  free(sortedgrid);
 
-  // calculate all item statuses
-  float itstats[size*size];
   for (i = 0; i < size * size; ++i) {
     if (lowmark != highmark) 
       itstats[i] = (sim -> grid[i].item - lowmark)/(highmark-lowmark);
     else
       itstats[i] = 0.0;
   }
+  *lowmarkp = lowmark;
+  *highmarkp = highmark;
+}
 
-  // calculate all utilitygains
-  float utgains[size*size];
+/* utgains_exact: sum the utility of all agent pairs; each agent's sum
+   runs over the others in index order, one float term at a time, so the
+   threaded or tiled row sweep, which visits every pair twice, gives the
+   same floats as the triangular one */
+static void utgains_exact(Simulation * sim, float * itstats, float * utgains)
+{
+  int size = sim -> size;
+  int i, j;
+  sim -> numastat.bytes += (double) size * size * size * size * sizeof(Agent);
+  int threaded = 0;
+#ifdef _OPENMP
+  threaded = omp_get_max_threads() > 1;
+#endif
+  if (threaded || sim -> pairtile) {
+    utgains_rows(sim, itstats, utgains, 0, size * size);
+    return;
+  }
   // init to zero
   for (i = 0; i < size * size; ++i) 
     utgains[i] = 0.0;
-  int j;
   for (i = 0; i < size * size; ++i) {
     for (j = i + 1; j < size * size; ++j) {
       Agent a1 = sim -> grid[i];
@@ -220,58 +672,516 @@ static void step(Simulation * sim)
       // calculate conformity
       float socdist = fabs(a1.status - a2.status);
       float itdist = fabs(a1.item - a2.item);
-      float conf;
-      float confdev = fabs(socdist-itdist); // deviation from line (0,0)-(1,1)
-      if (confdev < sim -> deviationfactor) 
-	conf = convert(confdev,0.0,sim -> deviationfactor,1.0,0.0); 
-      else
-	conf = convert(confdev,sim -> deviationfactor,1.0,0.0,-1.0);
+      float conf = conformity(sim, socdist, itdist);
       float c = sim -> c;
-      float eucldist = distance(i,j,size);
+      float eucldist = torus_distance(i,j,size);
       float ut1 = (c*(itstats[i] - itstats[j]) + (1.0-c)*conf)/(pow(eucldist,(float) sim -> distpower));
       float ut2 = (c*(itstats[j] - itstats[i]) + (1.0-c)*conf)/(pow(eucldist,(float) sim -> distpower));
       utgains[i] += ut1;
       utgains[j] += ut2;
     }
   }
+}
 
-  // update the agents
-  for (i = 0; i < size * size; ++i) {
-    newgrid[i].utility += utgains[i];
-    newgrid[i].age++;
-    if (newgrid[i].age > sim -> maxage) {
-      // determine drift
-      float drift;
-      if (newgrid[i].utility > 0) {
-	drift = rand01() * 0.02 - 0.01;
-      } else { // drift
-	drift = (rand01()*2.0 -1.0) * sim -> driftfactor * fabs(newgrid[i].utility);
+/* utgains_rows: the sums of agents i0..i1-1 over all others in index
+   order. With pairtile set, blocks of PAIR_ROWS agents take the others
+   a tile of pairtile agents at a time, which stays in cache for the
+   whole block; the order per agent, and so the floats, are the same */
+static void utgains_rows(Simulation * sim, float * itstats, float * utgains, int i0, int i1)
+{
+  int size = sim -> size;
+  int n = size * size;
+  int tile = sim -> pairtile;
+  int i, j;
+  if (!tile) {
+#pragma omp parallel for private(j) schedule(dynamic, 16)
+    for (i = i0; i < i1; ++i) {
+      Agent a1 = sim -> grid[i];
+      float sum = 0.0;
+      for (j = 0; j < size * size; ++j) {
+	if (j == i)
+	  continue;
+	Agent a2 = sim -> grid[j];
+	float socdist = fabs(a1.status - a2.status);
+	float itdist = fabs(a1.item - a2.item);
+	float conf = conformity(sim, socdist, itdist);
+	float c = sim -> c;
+	float eucldist = torus_distance(i,j,size);
+	float ut = (c*(itstats[i] - itstats[j]) + (1.0-c)*conf)/(pow(eucldist,(float) sim -> distpower));
+	sum += ut;
       }
-      newgrid[i].item = min(1.0,max(0.0,drift + newgrid[i].item));
-      newgrid[i].age = 0;
-      newgrid[i].utility = 0.0;
-    }  
+      utgains[i] = sum;
+    }
+    return;
   }
+  int nblocks = (i1 - i0 + PAIR_ROWS - 1) / PAIR_ROWS;
+  int b;
+#pragma omp parallel for private(i, j) schedule(dynamic, 1)
+  for (b = 0; b < nblocks; ++b) {
+    int r0 = i0 + b * PAIR_ROWS;
+    int r1 = min(r0 + PAIR_ROWS, i1);
+    float sums[PAIR_ROWS] = {0.0};
+    int j0;
+    for (j0 = 0; j0 < n; j0 += tile) {
+      int j1 = min(j0 + tile, n);
+      for (i = r0; i < r1; ++i) {
+	Agent a1 = sim -> grid[i];
+	float sum = sums[i - r0];
+	for (j = j0; j < j1; ++j) {
+	  if (j == i)
+	    continue;
+	  Agent a2 = sim -> grid[j];
+	  float socdist = fabs(a1.status - a2.status);
+	  float itdist = fabs(a1.item - a2.item);
+	  float conf = conformity(sim, socdist, itdist);
+	  float c = sim -> c;
+	  float eucldist = torus_distance(i,j,size);
+	  float ut = (c*(itstats[i] - itstats[j]) + (1.0-c)*conf)/(pow(eucldist,(float) sim -> distpower));
+	  sum += ut;
+	}
+	sums[i - r0] = sum;
+      }
+    }
+    for (i = r0; i < r1; ++i)
+      utgains[i] = sums[i - r0];
+  }
+}
 
-  free(sim -> grid);
-  sim -> grid = newgrid;
+/*
+ * utgains_fft: utility through toroidal convolutions with K = 1 / d^p
+ *
+ * The linear term sums to c * (itstats[i] * K_total - (K * itstats)[i]).
+ * For the conformity term every agent spreads a unit mass bilinearly over
+ * the nbins x nbins (status, item) nodes; each node field is convolved
+ * with K and weighted by the conformity between the agent and the node.
+ * Conformity is piecewise linear, so the error stems from its kinks only.
+ */
+static void utgains_fft(Simulation * sim, float * itstats, float * utgains)
+{
+  int n = sim -> size * sim -> size;
+  int nb = sim -> nbins;
+  double * in1 = sim -> convbuf;
+  double * in2 = in1 + n;
+  double * out1 = in2 + n;
+  double * out2 = out1 + n;
+  double * lin = out2 + n;
+  double * conf = lin + n;
+  int i;
+
+  // linear term
+  for (i = 0; i < n; ++i)
+    in1[i] = itstats[i];
+  torusconv_apply2(sim -> conv, in1, NULL, lin, NULL);
+
+  // node cell and weights of every agent
+#pragma omp parallel for schedule(static)
+  for (i = 0; i < n; ++i) {
+    float fs = sim -> grid[i].status * (nb - 1);
+    float fx = sim -> grid[i].item * (nb - 1);
+    int bs = min((int) fs, nb - 2);
+    int bx = min((int) fx, nb - 2);
+    sim -> nodecell[i] = bs * nb + bx;
+    sim -> nodeweight[2 * i] = fs - bs;
+    sim -> nodeweight[2 * i + 1] = fx - bx;
+    conf[i] = 0.0;
+  }
+
+  // conformity term, two node fields per transform
+  int q;
+  for (q = 0; q < nb * nb; q += 2) {
+    double * in[2] = {in1, in2};
+    int k;
+    for (k = 0; k < 2 && q + k < nb * nb; ++k) {
+      int node = q + k;
+#pragma omp parallel for schedule(static)
+      for (i = 0; i < n; ++i) {
+	int d = node - sim -> nodecell[i];
+	float ws = sim -> nodeweight[2 * i];
+	float wx = sim -> nodeweight[2 * i + 1];
+	if (d == 0)
+	  in[k][i] = (1.0 - ws) * (1.0 - wx);
+	else if (d == 1)
+	  in[k][i] = (1.0 - ws) * wx;
+	else if (d == nb)
+	  in[k][i] = ws * (1.0 - wx);
+	else if (d == nb + 1)
+	  in[k][i] = ws * wx;
+	else
+	  in[k][i] = 0.0;
+      }
+    }
+    int pair = (q + 1 < nb * nb);
+    torusconv_apply2(sim -> conv, in1, pair ? in2 : NULL, out1, pair ? out2 : NULL);
+    for (k = 0; k < 1 + pair; ++k) {
+      float ts = (float) ((q + k) / nb) / (nb - 1);
+      float tx = (float) ((q + k) % nb) / (nb - 1);
+      double * out = k ? out2 : out1;
+#pragma omp parallel for schedule(static)
+      for (i = 0; i < n; ++i)
+	conf[i] += conformity(sim, fabs(sim -> grid[i].status - ts), fabs(sim -> grid[i].item - tx)) * out[i];
+    }
+  }
+
+  float c = sim -> c;
+  for (i = 0; i < n; ++i)
+    utgains[i] = c * (itstats[i] * sim -> ktotal - lin[i]) + (1.0 - c) * conf[i];
+}
+
+/* checkengine: compare utgains to the exact sums, which replace them for
+   this step; above tolerance fft nodes double and incremental sums are
+   rebuilt */
+static void checkengine(Simulation * sim, float * itstats, float * utgains)
+{
+  int n = sim -> size * sim -> size;
+  float * exact = (float *) malloc(n * sizeof(float));
+  assert(exact);
+  utgains_exact(sim, itstats, exact);
+  double maxdiff = 0.0, maxabs = 0.0;
+  int i;
+  for (i = 0; i < n; ++i) {
+    maxdiff = max(maxdiff, fabs(utgains[i] - exact[i]));
+    maxabs = max(maxabs, fabs(exact[i]));
+    utgains[i] = exact[i];
+  }
+  free(exact);
+  float error = (maxabs > 0.0) ? maxdiff / maxabs : maxdiff;
+  sim -> maxerror = max(sim -> maxerror, error);
+  sim -> nchecks++;
+  if (sim -> engine == ENGINE_FFT && error > sim -> tolerance && sim -> nbins < FFT_MAXBINS)
+    sim -> nbins = min(2 * sim -> nbins, FFT_MAXBINS);
+  if (sim -> engine == ENGINE_INCR && error > sim -> tolerance)
+    incr_build(sim);
+}
+
+/*
+ * utgains_incr: utility from cached per-agent sums
+ *
+ * Statuses never change and items only at rebirth, so each agent keeps
+ * itemsum = sum_j K_ij item_j and confsum = sum_j K_ij conf_ij, updated by
+ * incr_rebirth(). With itstats = (item - lowmark) * itscale the linear
+ * term is c * itscale * (item_i * K_total - itemsum_i).
+ */
+static void utgains_incr(Simulation * sim, float itscale, float * utgains)
+{
+  int n = sim -> size * sim -> size;
+  float c = sim -> c;
+  int i;
+  for (i = 0; i < n; ++i)
+    utgains[i] = c * itscale * (sim -> grid[i].item * sim -> ktotal - sim -> itemsum[i])
+      + (1.0 - c) * sim -> confsum[i];
+}
+
+/* incr_setup: the kernel table and the buffers of the cached sums,
+   which incr_build() fills */
+static void incr_setup(Simulation * sim)
+{
+  int n = sim -> size * sim -> size;
+  sim -> kernel = (float *) malloc(n * sizeof(float));
+  sim -> confsum = (double *) calloc(n, sizeof(double));
+  sim -> itemsum = (double *) calloc(n, sizeof(double));
+  sim -> incrbuf = (double *) malloc(n * sizeof(double));
+  assert(sim -> kernel && sim -> confsum && sim -> itemsum && sim -> incrbuf);
+  sim -> ktotal = 0.0;
+  int i;
+  for (i = 1; i < n; ++i) {
+    float eucldist = torus_distance(0, i, sim -> size);
+    sim -> kernel[i] = 1.0 / pow(eucldist, (float) sim -> distpower);
+    sim -> ktotal += sim -> kernel[i];
+  }
+  sim -> kernel[0] = 0.0;
+}
+
+static void incr_release(Simulation * sim)
+{
+  free(sim -> kernel);
+  free(sim -> confsum);
+  free(sim -> itemsum);
+  free(sim -> incrbuf);
+  sim -> kernel = NULL;
+  sim -> confsum = NULL;
+  sim -> itemsum = NULL;
+  sim -> incrbuf = NULL;
+}
+
+/* incr_build: full O(N^2) computation of the cached sums */
+static void incr_build(Simulation * sim)
+{
+  int n = sim -> size * sim -> size;
+  int i, j;
+#pragma omp parallel for private(j) schedule(dynamic, 16)
+  for (i = 0; i < n; ++i) {
+    Agent a1 = sim -> grid[i];
+    double isum = 0.0, csum = 0.0;
+    for (j = 0; j < n; ++j) {
+      if (j == i)
+	continue;
+      Agent a2 = sim -> grid[j];
+      float w = kernelat(sim, i, j);
+      isum += w * a2.item;
+      csum += w * conformity(sim, fabs(a1.status - a2.status), fabs(a1.item - a2.item));
+    }
+    sim -> itemsum[i] = isum;
+    sim -> confsum[i] = csum;
+  }
+  sim -> numastat.bytes += (double) n * n * sizeof(Agent);
+}
+
+/* incr_rebirth: agent r's item went from olditem to its current value.
+   Every other agent's sums get the pair's delta; r's own conformity sum
+   is recomputed, so no rounding carries over a lifetime. By symmetry of
+   conformity the new pair terms are the ones r's sum needs. */
+static void incr_rebirth(Simulation * sim, int r, float olditem)
+{
+  Agent ar = sim -> grid[r];
+  float delta = ar.item - olditem;
+  if (delta == 0.0)
+    return;
+  int n = sim -> size * sim -> size;
+  double * fresh = sim -> incrbuf;
+  int j;
+#pragma omp parallel for schedule(static) if (n >= 4096)
+  for (j = 0; j < n; ++j) {
+    if (j == r) {
+      fresh[j] = 0.0;
+      continue;
+    }
+    Agent aj = sim -> grid[j];
+    float w = kernelat(sim, r, j);
+    float socdist = fabs(ar.status - aj.status);
+    double cnew = w * conformity(sim, socdist, fabs(ar.item - aj.item));
+    double cold = w * conformity(sim, socdist, fabs(olditem - aj.item));
+    sim -> confsum[j] += cnew - cold;
+    sim -> itemsum[j] += w * delta;
+    fresh[j] = cnew;
+  }
+  double sum = 0.0;
+  for (j = 0; j < n; ++j)
+    sum += fresh[j];
+  sim -> confsum[r] = sum;
+  sim -> numastat.bytes += (double) n * sizeof(Agent);
+}
+
+/* kernelat: 1 / d^p between agents i and j, 0 for i == j */
+static float kernelat(Simulation * sim, int i, int j)
+{
+  int size = sim -> size;
+  int dx = abs(i / size - j / size);
+  int dy = abs(i % size - j % size);
+  return sim -> kernel[dx * size + dy];
+}
+
+/*
+ * step_tiled: one step with the kernel cut off at the radius
+ *
+ * The grid is swept tile by tile, a tile being a band of tilerows rows;
+ * the gains of a tile read its halo, the tiles within the radius, and go
+ * straight into the utilities, which no gain reads. A tile is reborn once
+ * no tile left to sweep has it in its halo, so a sweep reads every tile
+ * once. The first tiles are in the halo of the last ones across the wrap:
+ * their new items wait in a side buffer until the sweep is done, which
+ * keeps rebirth, random numbers and event log in index order.
+ */
+static void step_tiled(Simulation * sim)
+{
+  int size = sim -> size;
+  if (sim -> marksclock != sim -> ageclock)
+    streammarks(sim, NULL, NULL);
+  float itscale = (sim -> lowmark != sim -> highmark) ? 1.0 / (sim -> highmark - sim -> lowmark) : 0.0;
+  int rows = sim -> tilerows;
+  int ntiles = (size + rows - 1) / rows;
+  int halo = (min(sim -> radius, size / 2) + rows - 1) / rows;
+  int wrap = (2 * halo + 1 >= ntiles); // all tiles in every halo
+
+  int cycle = sim -> maxage + 1;
+  int phase = ((sim -> maxage - sim -> ageclock) % cycle + cycle) % cycle;
+  float * deferred = NULL;
+  int first = sim -> cohortstart[phase];
+  if (!wrap) {
+    int ndeferred = cohortfrom(sim, phase, halo * rows * size) - first;
+    deferred = (float *) malloc((ndeferred + 1) * sizeof(float));
+    assert(deferred);
+  }
+  int t, k;
+  for (t = 0; t < ntiles; ++t) {
+    tiles_window(sim -> gridtiles, t, halo);
+    gains_tile(sim, t, itscale);
+    if (!wrap && t >= halo)
+      rebirth_tile(sim, t - halo, phase, (t - halo < halo) ? deferred : NULL);
+  }
+  for (t = wrap ? 0 : ntiles - halo; t < ntiles; ++t)
+    rebirth_tile(sim, t, phase, NULL);
+  if (!wrap) {
+    int last = cohortfrom(sim, phase, halo * rows * size);
+    for (k = first; k < last; ++k)
+      sim -> grid[sim -> cohorts[k]].item = deferred[k - first];
+    free(deferred);
+  }
+  if (EVENTREPORT)
+    eventlog_endstep(sim -> eventlog);
+  sim -> ageclock++;
+}
+
+/* gains_tile: add the utility gains of the agents in tile t; the linear
+   term is c * (itstats[i] - itstats[j]) with itstats affine in the items */
+static void gains_tile(Simulation * sim, int t, float itscale)
+{
+  int size = sim -> size;
+  int x0 = t * sim -> tilerows;
+  int x1 = min(x0 + sim -> tilerows, size);
+  float c = sim -> c;
+  int i, s;
+#pragma omp parallel for private(s) schedule(static)
+  for (i = x0 * size; i < x1 * size; ++i) {
+    Agent a1 = sim -> grid[i];
+    int x = i / size;
+    int y = i % size;
+    float sum = 0.0;
+    for (s = 0; s < sim -> nstencil; ++s) {
+      int xj = x + sim -> stencilx[s];
+      int yj = y + sim -> stencily[s];
+      if (xj >= size)
+	xj -= size;
+      if (yj >= size)
+	yj -= size;
+      Agent a2 = sim -> grid[xj * size + yj];
+      float conf = conformity(sim, fabs(a1.status - a2.status), fabs(a1.item - a2.item));
+      sum += (c * (a1.item - a2.item) * itscale + (1.0 - c) * conf) * sim -> stencilw[s];
+    }
+    sim -> grid[i].utility += sum;
+  }
+  sim -> numastat.bytes += (double) (x1 - x0) * size * sim -> nstencil * sizeof(Agent);
+}
+
+/* rebirth_tile: rebirth of the cohort of phase in tile t, new items to
+   deferred if set, indexed from the start of the cohort */
+static void rebirth_tile(Simulation * sim, int t, int phase, float * deferred)
+{
+  int size = sim -> size;
+  int from = t * sim -> tilerows * size;
+  int to = min((t + 1) * sim -> tilerows, size) * size;
+  int first = sim -> cohortstart[phase];
+  int k;
+  for (k = cohortfrom(sim, phase, from); k < sim -> cohortstart[phase + 1] && sim -> cohorts[k] < to; ++k)
+    rebirth(sim, sim -> cohorts[k], deferred ? &deferred[k - first] : NULL);
+}
+
+/* cohortfrom: position of the first agent with index >= idx in the
+   cohort of phase, which is in index order */
+static int cohortfrom(Simulation * sim, int phase, int idx)
+{
+  int lo = sim -> cohortstart[phase];
+  int hi = sim -> cohortstart[phase + 1];
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (sim -> cohorts[mid] < idx)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/*
+ * set_marks: the low and high mark groups of the tiled engine
+ *
+ * The marks average the items of the lowest and highest markpercentile
+ * agents by status. Statuses never change, so instead of sorting a copy
+ * of the grid every step the groups are fixed once by two boundary
+ * statuses; ties at a boundary are split by index.
+ */
+static void set_marks(Simulation * sim)
+{
+  int n = sim -> size * sim -> size;
+  int lowcount = (int) ((float) n * sim -> markpercentile);
+  if (lowcount <= 0) {
+    sim -> lowstatus = -1.0;
+    sim -> lowties = 0;
+    sim -> highstatus = INFINITY;
+    sim -> highskip = 0;
+    return;
+  }
+  int nless;
+  sim -> lowstatus = statusrank(sim, lowcount - 1, &nless);
+  sim -> lowties = lowcount - nless;
+  sim -> highstatus = statusrank(sim, n - lowcount, &nless);
+  sim -> highskip = n - lowcount - nless;
+}
+
+/* statusrank: the k-th smallest status, counting from 0, and the number
+   of agents below it; statuses are non-negative, so their bits order as
+   unsigned ints and two histogram passes over the grid find it */
+static float statusrank(Simulation * sim, int k, int * nless)
+{
+  int n = sim -> size * sim -> size;
+  int * hist = (int *) malloc(65536 * sizeof(int));
+  assert(hist);
+  unsigned int prefix = 0;
+  int below = 0;
+  int pass, i, b;
+  for (pass = 0; pass < 2; ++pass) {
+    memset(hist, 0, 65536 * sizeof(int));
+    for (i = 0; i < n; ++i) {
+      unsigned int bits;
+      memcpy(&bits, &sim -> grid[i].status, sizeof(float));
+      if (pass == 0)
+	hist[bits >> 16]++;
+      else if ((bits >> 16) == prefix)
+	hist[bits & 0xffff]++;
+    }
+    for (b = 0; below + hist[b] <= k; ++b)
+      below += hist[b];
+    prefix = pass ? (prefix << 16) | b : (unsigned int) b;
+  }
+  free(hist);
+  *nless = below;
+  float status;
+  memcpy(&status, &prefix, sizeof(float));
+  return status;
+}
+
+/* streammarks: marks of the current grid in one pass, plus the report
+   bins and item sum when asked for */
+static void streammarks(Simulation * sim, int * bin, float * itemsum)
+{
+  int n = sim -> size * sim -> size;
+  double lowsum = 0.0, highsum = 0.0;
+  int lowseen = 0, highseen = 0;
+  int i;
+  for (i = 0; i < n; ++i) {
+    Agent a = sim -> grid[i];
+    if (bin) {
+      bin[(int) round(a.item * 10.0)]++;
+      *itemsum += a.item;
+    }
+    if (a.status < sim -> lowstatus || (a.status == sim -> lowstatus && lowseen++ < sim -> lowties))
+      lowsum += a.item;
+    if (a.status > sim -> highstatus || (a.status == sim -> highstatus && highseen++ >= sim -> highskip))
+      highsum += a.item;
+  }
+  int lowcount = (int) ((float) n * sim -> markpercentile);
+  sim -> lowmark = lowsum / lowcount;
+  sim -> highmark = highsum / lowcount;
+  sim -> marksclock = sim -> ageclock;
 }
 
 static void report(Simulation * sim)
 {
   // calculate bins and itemsum
   int size = sim -> size;
-  Agent * sorted = (Agent *) malloc(size * size * sizeof(Agent));
+  Agent * sorted = sim -> sortedgrid;
   int i;
   int bin[11] = {0};
   float itemsum = 0.0;
-  for (i = 0; i < size * size; ++i) {
-    sorted[i] = sim -> grid[i];
-    bin[(int) round(sorted[i].item * 10.0)]++;
-    itemsum += sorted[i].item;
-  }
+  if (sim -> engine == ENGINE_TILED)
+    streammarks(sim, bin, &itemsum);
+  else
+    for (i = 0; i < size * size; ++i) {
+      sorted[i] = sim -> grid[i];
+      bin[(int) round(sorted[i].item * 10.0)]++;
+      itemsum += sorted[i].item;
+    }
   // calc mostfrequent and determine whether it has changed
-  int mostfrequent = maxidx(bin, 11);
+  int mostfrequent = torus_maxidx_int(bin, 11);
   if (sim -> mostfrequent != mostfrequent) {
     sim -> numberofchanges++;
     sim -> mostfrequent = mostfrequent;
@@ -279,29 +1189,32 @@ static void report(Simulation * sim)
   // calc homog & avgitem
   float homogeneity = (float) bin[mostfrequent] / (size*size);
   sim -> tothomog += homogeneity;
+  metrics_publish(sim -> metrics, sim -> currentstep, sim -> mostfrequent, homogeneity, sim -> numastat.seconds);
   float avgitem = itemsum / (size*size);
   // calc lowmark & highmark
-  
-  // sort the grid into sortedgrid
-  qsort(sorted, size*size, sizeof(Agent), cmp_stat);
+  float lowmark = sim -> lowmark;
+  float highmark = sim -> highmark;
+  if (sim -> engine != ENGINE_TILED) {
+    // sort the grid into sortedgrid
+    qsort(sorted, size*size, sizeof(Agent), cmp_stat);
 
-  // determine high and lowmarks
-  int lowpercentilemark = (int) ((float) (size * size) * (sim -> markpercentile));
-  int highpercentilemark = size * size - lowpercentilemark;
+    // determine high and lowmarks
+    int lowpercentilemark = (int) ((float) (size * size) * (sim -> markpercentile));
+    int highpercentilemark = size * size - lowpercentilemark;
   
-  float itsum = 0.0;
-  for (i = 0; i < lowpercentilemark; ++i)
-    itsum += sorted[i].item;
-  float lowmark = itsum / lowpercentilemark;
-  itsum = 0.0;
-  for (i = highpercentilemark; i < size * size; ++i)
-    itsum += sorted[i].item;
-  float highmark = itsum / lowpercentilemark;
-  free(sorted);
+    float itsum = 0.0;
+    for (i = 0; i < lowpercentilemark; ++i)
+      itsum += sorted[i].item;
+    lowmark = itsum / lowpercentilemark;
+    itsum = 0.0;
+    for (i = highpercentilemark; i < size * size; ++i)
+      itsum += sorted[i].item;
+    highmark = itsum / lowpercentilemark;
+  }
   
   // write to short report
   fprintf(sim -> shortreportFP, 
-	  "%d\t%d\t%.3f\t%.3f\t%.3f\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n", 
+	  "%d\t%d\t%.3f\t%.3f\t%.3f\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d", 
 	  sim -> currentstep,
 	  sim -> mostfrequent,
 	  lowmark,
@@ -318,6 +1231,22 @@ static void report(Simulation * sim)
 	  bin[8],
 	  bin[9],
 	  bin[10]);
+  if (SPATIALREPORT) {
+    // same-item regions are taken over the report bins
+    int * labels = (int *) malloc(size * size * sizeof(int));
+    float * values = (float *) malloc(size * size * sizeof(float));
+    assert(labels && values);
+    for (i = 0; i < size * size; ++i) {
+      labels[i] = (int) round(sim -> grid[i].item * 10.0);
+      values[i] = sim -> grid[i].item;
+    }
+    SpatialStats stats;
+    spatialstats(labels, values, size, 11, &stats);
+    spatialstats_fprint(sim -> shortreportFP, &stats);
+    free(labels);
+    free(values);
+  }
+  fprintf(sim -> shortreportFP, "\n");
 
   if (LONGREPORT) {
     // write to long report
@@ -326,13 +1255,26 @@ static void report(Simulation * sim)
 	      "%.3f %.3f %d %.3f ",
 	      sim -> grid[i].status,
 	      sim -> grid[i].item,
-	      sim -> grid[i].age,
+	      agentage(sim, i),
 	      sim -> grid[i].utility);
     fprintf(sim -> longreportFP,"\n");
   }
 
 }
 
+/* reportevent: log agent idx if its item changes, utility is not logged */
+static void reportevent(Simulation * sim, int idx, float item)
+{
+  Agent a = sim -> grid[idx];
+  if (item != a.item) {
+    unsigned int oldfields[2], newfields[2];
+    agentfields(&a, oldfields);
+    a.item = item;
+    agentfields(&a, newfields);
+    eventlog_change(sim -> eventlog, idx, oldfields, newfields);
+  }
+}
+
 static void reportfinal(Simulation * sim)
 {
   fprintf(sim -> finalreportFP,"0. Simulation summary:\n");
@@ -364,6 +1306,24 @@ static void reportfinal(Simulation * sim)
   fprintf(sim -> finalreportFP,"12. Number of changes:\t%d\n",sim -> numberofchanges);
   fprintf(sim -> finalreportFP,"13. Average homogeneity:\t%.5f\n",(sim -> tothomog) / (sim -> nsteps));
   fprintf(sim -> finalreportFP,"14. Mark percentile:\t%.5f\n",(sim -> markpercentile));
+  if (sim -> engine == ENGINE_FFT) {
+    fprintf(sim -> finalreportFP,"15. Engine:\tFFT\n");
+    fprintf(sim -> finalreportFP,"16. Tolerance:\t%.5f\n",sim -> tolerance);
+    fprintf(sim -> finalreportFP,"17. Conformity nodes:\t%d\n",sim -> nbins);
+    fprintf(sim -> finalreportFP,"18. Max relative utility error:\t%.5f\n",sim -> maxerror);
+    fprintf(sim -> finalreportFP,"19. Checks:\t%d\n",sim -> nchecks);
+  } else if (sim -> engine == ENGINE_INCR) {
+    fprintf(sim -> finalreportFP,"15. Engine:\tINCREMENTAL\n");
+    fprintf(sim -> finalreportFP,"16. Tolerance:\t%.5f\n",sim -> tolerance);
+    fprintf(sim -> finalreportFP,"17. Max relative utility error:\t%.5f\n",sim -> maxerror);
+    fprintf(sim -> finalreportFP,"18. Checks:\t%d\n",sim -> nchecks);
+  } else if (sim -> engine == ENGINE_TILED) {
+    fprintf(sim -> finalreportFP,"15. Engine:\tTILED\n");
+    fprintf(sim -> finalreportFP,"16. Radius:\t%d\n",sim -> radius);
+    fprintf(sim -> finalreportFP,"17. Neighbours:\t%d\n",sim -> nstencil);
+    fprintf(sim -> finalreportFP,"18. Rows per tile:\t%d\n",sim -> tilerows);
+    fprintf(sim -> finalreportFP,"19. Out of core:\t%s\n",(sim -> gridtiles) ? "YES" : "NO");
+  }
 }
 
 static void end_sim(Simulation * sim)
@@ -372,31 +1332,54 @@ static void end_sim(Simulation * sim)
   fclose(sim -> shortreportFP);
   if (LONGREPORT)
     fclose(sim -> longreportFP);
+  if (NUMAREPORT) {
+    int n = sim -> size * sim -> size;
+    void * buffers[5] = {sim -> grid, sim -> cohorts, sim -> sortedgrid, sim -> itstats, sim -> utgains};
+    size_t sizes[5] = {n * sizeof(Agent), n * sizeof(int), n * sizeof(Agent), n * sizeof(float), n * sizeof(float)};
+    numa_report(sim -> finalreportFP, &sim -> numastat, buffers, sizes, (sim -> sortedgrid) ? 5 : 2);
+  }
   fclose(sim -> finalreportFP);
+  if (EVENTREPORT)
+    eventlog_close(sim -> eventlog);
   sim_free(sim);
 }
 
-static int maxidx(int * arr, int size)
-{
-  int i;
-  int maxidx = 0;
-  for (i = 1; i < size; ++i) {
-    if (arr[i] > arr[maxidx])
-      maxidx = i;
-  }
-  return maxidx;
-}
-
 static void sim_free(Simulation * sim)
 {
-  free(sim -> grid);
+  metrics_close(sim -> metrics);
+  int n = sim -> size * sim -> size;
+  free(sim -> cohortstart);
+  free(sim -> stencilx);
+  free(sim -> stencily);
+  free(sim -> stencilw);
+  if (sim -> gridtiles) {
+    tiles_close(sim -> gridtiles);
+    tiles_close(sim -> cohorttiles);
+  } else {
+    numa_free(sim -> cohorts, n * sizeof(int));
+    numa_free(sim -> grid, n * sizeof(Agent));
+  }
+  if (sim -> conv)
+    torusconv_free(sim -> conv);
+  free(sim -> convbuf);
+  free(sim -> nodecell);
+  free(sim -> nodeweight);
+  free(sim -> kernel);
+  free(sim -> confsum);
+  free(sim -> itemsum);
+  free(sim -> incrbuf);
+  numa_free(sim -> sortedgrid, n * sizeof(Agent));
+  numa_free(sim -> itstats, n * sizeof(float));
+  numa_free(sim -> utgains, n * sizeof(float));
   free(sim);
 }
 
 /* helper functions */
-static float rand01() 
+
+/* agentage: age of agent idx in the current grid, ages run 0..maxage */
+static int agentage(Simulation * sim, int idx)
 {
-  return (float) rand() / ((float) RAND_MAX + 1);
+  return (sim -> grid[idx].phase + sim -> ageclock) % (sim -> maxage + 1);
 }
 
 /* makefilename: prepare reportfilenames */
@@ -421,23 +1404,22 @@ static char * makefilename(Simulation * sim, char * stem, char * type)
   return buffer;
 }
 
-/* distance: calculate euclidean distance from array indices */
-static float distance(int pos1, int pos2, int size) 
+/* agentfields: status and item bits for the event log */
+static void agentfields(Agent * a, unsigned int * fields)
 {
-  int x1 = pos1 / size;
-  int y1 = pos1 % size;
-  int x2 = pos2 / size;
-  int y2 = pos2 % size;
-
-  int xdiff = fabs(x1 - x2);
-  int ydiff = fabs(y1 - y2);
-  
-  xdiff = min(xdiff, fabs(size - xdiff));
-  ydiff = min(ydiff, fabs(size - ydiff));
-
-  return sqrt(xdiff*xdiff + ydiff*ydiff);
+  memcpy(&fields[0], &a -> status, sizeof(float));
+  memcpy(&fields[1], &a -> item, sizeof(float));
 }
 
+/* conformity: 1 on the line (0,0)-(1,1), 0 at deviationfactor, -1 at 1 */
+static float conformity(Simulation * sim, float socdist, float itdist)
+{
+  float confdev = fabs(socdist-itdist); // deviation from line (0,0)-(1,1)
+  if (confdev < sim -> deviationfactor) 
+    return convert(confdev,0.0,sim -> deviationfactor,1.0,0.0); 
+  else
+    return convert(confdev,sim -> deviationfactor,1.0,0.0,-1.0);
+}
 
 /* range scaler */
 static float convert(float x, float inmin, float inmax, float outmin, float outmax)
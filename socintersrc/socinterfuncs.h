@@ -8,10 +8,26 @@
 #ifndef SOCINTERFUNCS_H_
 #define SOCINTERFUNCS_H_
 
+#include "eventlog.h"
+#include "fft.h"
+#include "numa.h"
+#include "rng.h"
+#include "tiles.h"
+#include "metrics.h"
+
+#define ENGINE_AUTO -1 /* fastest within tolerance, see autotune() */
+#define ENGINE_EXACT 0
+#define ENGINE_FFT 1
+#define ENGINE_INCR 2
+#define ENGINE_TILED 3
+#define ENGINE_TOLERANCE 0.01 /* default relative utility error at checks */
+#define TILED_RADIUS 8 /* tiled engine: default interaction radius */
+
+/* an agent's age is (phase + ageclock) % (maxage + 1) */
 typedef struct {
   float status;
   float item;
-  int age;
+  int phase;
   float utility;
 } Agent;
 
@@ -32,10 +48,50 @@ typedef struct {
   FILE * shortreportFP;
   FILE * longreportFP;
   FILE * finalreportFP;
+  EventLog * eventlog;
+  Metrics * metrics; /* live metrics with LIVEMETRICS, else NULL */
   int mostfrequent;
   int numberofchanges;
   float tothomog;
   int currentstep;
+  int ageclock; /* steps applied to the grid */
+  int * cohortstart; /* cohorts[cohortstart[p]..cohortstart[p+1]) has phase p */
+  int * cohorts;
+  int engine; /* ENGINE_EXACT, ENGINE_FFT, ENGINE_INCR, ENGINE_TILED */
+  float tolerance;
+  int nbins; /* fft: conformity nodes per dimension */
+  TorusConv * conv;
+  double ktotal;
+  double * convbuf;
+  int * nodecell;
+  float * nodeweight;
+  float maxerror; /* fft: largest relative utility error at check steps */
+  int nchecks;
+  float * kernel; /* incr: 1 / d^p by displacement */
+  double * confsum; /* incr: kernel weighted conformity and item sums */
+  double * itemsum;
+  double * incrbuf;
+  int pairtile; /* exact: agents per tile of the pair sweep, 0: untiled */
+  int radius; /* tiled: interaction radius, see set_radius() */
+  int tilerows; /* tiled: grid rows per tile */
+  int nstencil; /* tiled: neighbour offsets within the radius */
+  int * stencilx;
+  int * stencily;
+  float * stencilw;
+  float lowstatus; /* tiled: the mark groups by status, see set_marks() */
+  float highstatus;
+  int lowties; /* agents at lowstatus in the low group, first in index order */
+  int highskip; /* agents at highstatus not in the high group, idem */
+  float lowmark; /* tiled: marks of the grid at marksclock */
+  float highmark;
+  int marksclock;
+  TileFile * gridtiles; /* OUTOFCORE: grid and cohorts in mapped files */
+  TileFile * cohorttiles;
+  Agent * sortedgrid; /* persistent step buffers */
+  float * itstats;
+  float * utgains;
+  NumaStat numastat;
+  Rng rng;
 } Simulation;
 
 
@@ -53,6 +109,8 @@ Simulation * init_sim(int size,
 		      float markpercentile,
 		      char * reportpath
 		      ); 
+void set_radius(Simulation *, int);
+void set_engine(Simulation *, int, float);
 void run(Simulation *);
 
 #endif /* SOCINTERFUNCS_H_ */
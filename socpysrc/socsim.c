@@ -0,0 +1,288 @@
+/*
+ * socsim.c
+ * python module over the social impact simulation: runs it in-process
+ * and shows its grid and short report series as buffers, without copies
+ * maarten
+ *
+ *   import socsim
+ *   s = socsim.Sim("out/", 60, 100, 3, 5, 0, 3, 1, 1, 1, 1.2, 0.1, 1.5)
+ *   s.step(10)                  # the GIL is released while it steps
+ *   grid = memoryview(s.grid)   # (size, size, 3) int32: item, status, phase
+ *   homog = s.series_homogeneity
+ *   s.finish()                  # final report; s.run() steps to the end
+ *
+ * The arguments are those of socimpact, samples last and optional. The
+ * report files are written as usual. The views are read-only and live:
+ * the grid view shows the grid as it is, the series views the steps
+ * taken when the view was made, and they keep the run alive as long as
+ * they exist. An agent's age is (phase + ageclock) % maxage + 1.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "socimpactfuncs.h"
+
+typedef struct {
+  PyObject_HEAD
+  Simulation * sim;
+  int stepping; /* a thread is in step() */
+  int finished; /* run_end() done */
+} SimObject;
+
+/* a region of a run's memory, shown through the buffer protocol */
+typedef struct {
+  PyObject_HEAD
+  SimObject * owner;
+  void * buf;
+  char * format;
+  int ndim;
+  Py_ssize_t shape[3];
+  Py_ssize_t strides[3];
+} ArrayObject;
+
+static PyTypeObject ArrayType;
+
+/* array_new: a view of buf in C order, itemsize 4 */
+static PyObject * array_new(SimObject * owner, void * buf, char * format, int ndim, Py_ssize_t * shape)
+{
+  ArrayObject * a = PyObject_New(ArrayObject, &ArrayType);
+  if (!a)
+    return NULL;
+  Py_INCREF(owner);
+  a -> owner = owner;
+  a -> buf = buf;
+  a -> format = format;
+  a -> ndim = ndim;
+  int d;
+  Py_ssize_t stride = 4;
+  for (d = ndim - 1; d >= 0; --d) {
+    a -> shape[d] = shape[d];
+    a -> strides[d] = stride;
+    stride *= shape[d];
+  }
+  PyObject * view = PyMemoryView_FromObject((PyObject *) a);
+  Py_DECREF(a);
+  return view;
+}
+
+static int array_getbuffer(ArrayObject * a, Py_buffer * view, int flags)
+{
+  if (flags & PyBUF_WRITABLE) {
+    PyErr_SetString(PyExc_BufferError, "socsim views are read-only");
+    return -1;
+  }
+  Py_ssize_t len = 4;
+  int d;
+  for (d = 0; d < a -> ndim; ++d)
+    len *= a -> shape[d];
+  view -> obj = (PyObject *) a;
+  Py_INCREF(a);
+  view -> buf = a -> buf;
+  view -> len = len;
+  view -> readonly = 1;
+  view -> itemsize = 4;
+  view -> format = (flags & PyBUF_FORMAT) ? a -> format : NULL;
+  view -> ndim = a -> ndim;
+  view -> shape = (flags & PyBUF_ND) ? a -> shape : NULL;
+  view -> strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? a -> strides : NULL;
+  view -> suboffsets = NULL;
+  view -> internal = NULL;
+  return 0;
+}
+
+static void array_dealloc(ArrayObject * a)
+{
+  Py_DECREF(a -> owner);
+  PyObject_Free(a);
+}
+
+static PyBufferProcs array_as_buffer = {
+  (getbufferproc) array_getbuffer,
+  NULL,
+};
+
+static PyTypeObject ArrayType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "socsim.Array",
+  .tp_basicsize = sizeof(ArrayObject),
+  .tp_dealloc = (destructor) array_dealloc,
+  .tp_as_buffer = &array_as_buffer,
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_doc = "A read-only region of a run's memory.",
+};
+
+static int sim_init(SimObject * self, PyObject * args, PyObject * kwds)
+{
+  char * path;
+  int size, nsteps, seed, maxage, agedistr, nitems, itemdistr, statdistr, learningmode, nsamples = 0;
+  float bias, murate, normimpact;
+  if (!PyArg_ParseTuple(args, "siiiiiiiiifff|i", &path, &size, &nsteps, &seed, &maxage, &agedistr,
+			&nitems, &itemdistr, &statdistr, &learningmode, &bias, &murate, &normimpact, &nsamples))
+    return -1;
+  if (self -> sim) {
+    PyErr_SetString(PyExc_RuntimeError, "Sim is already initialized");
+    return -1;
+  }
+  if (size < 1 || nsteps < 0 || maxage < 1 || nitems < 2 || statdistr < 0 || statdistr > 2) {
+    PyErr_SetString(PyExc_ValueError, "illegal size, steps, maximum age, items or status distribution");
+    return -1;
+  }
+  self -> sim = init_sim(size, nsteps, seed, maxage, agedistr, nitems, itemdistr, statdistr,
+			 learningmode, bias, murate, normimpact, path);
+  set_samples(self -> sim, nsamples);
+  set_series(self -> sim);
+  run_begin(self -> sim);
+  return 0;
+}
+
+static void sim_dealloc(SimObject * self)
+{
+  if (self -> sim) {
+    if (!self -> finished)
+      run_end(self -> sim);
+    free_sim(self -> sim);
+  }
+  Py_TYPE(self) -> tp_free((PyObject *) self);
+}
+
+/* sim_ready: 0 with an exception unless the run can take steps */
+static int sim_ready(SimObject * self)
+{
+  if (!self -> sim)
+    PyErr_SetString(PyExc_RuntimeError, "Sim is not initialized");
+  else if (self -> finished)
+    PyErr_SetString(PyExc_RuntimeError, "Sim is finished");
+  else if (self -> stepping)
+    PyErr_SetString(PyExc_RuntimeError, "Sim is stepping in another thread");
+  else
+    return 1;
+  return 0;
+}
+
+static PyObject * sim_step(SimObject * self, PyObject * args)
+{
+  int n = 1, taken;
+  if (!PyArg_ParseTuple(args, "|i", &n) || !sim_ready(self))
+    return NULL;
+  self -> stepping = 1;
+  Py_BEGIN_ALLOW_THREADS
+  taken = run_steps(self -> sim, n);
+  Py_END_ALLOW_THREADS
+  self -> stepping = 0;
+  return PyLong_FromLong(taken);
+}
+
+static PyObject * sim_run(SimObject * self, PyObject * unused)
+{
+  if (!sim_ready(self))
+    return NULL;
+  PyObject * args = Py_BuildValue("(i)", self -> sim -> nsteps);
+  PyObject * taken = sim_step(self, args);
+  Py_DECREF(args);
+  return taken;
+}
+
+static PyObject * sim_finish(SimObject * self, PyObject * unused)
+{
+  if (!sim_ready(self))
+    return NULL;
+  run_end(self -> sim);
+  self -> finished = 1;
+  Py_RETURN_NONE;
+}
+
+static PyObject * sim_grid(SimObject * self, void * closure)
+{
+  if (!self -> sim)
+    return PyErr_Format(PyExc_RuntimeError, "Sim is not initialized");
+  Py_ssize_t shape[3] = {self -> sim -> size, self -> sim -> size, sizeof(Agent) / sizeof(int)};
+  return array_new(self, self -> sim -> grid, "i", 3, shape);
+}
+
+/* sim_series: closure 0: item counts, 1: most frequent, 2: homogeneity,
+   3: the item counts of the current step */
+static PyObject * sim_series(SimObject * self, void * closure)
+{
+  if (!self -> sim)
+    return PyErr_Format(PyExc_RuntimeError, "Sim is not initialized");
+  Simulation * sim = self -> sim;
+  Py_ssize_t shape[2] = {sim -> currentstep + 1, sim -> nitems};
+  switch ((long) closure) {
+  case 0:
+    return array_new(self, sim -> seriesitems, "i", 2, shape);
+  case 1:
+    return array_new(self, sim -> seriesmostfrequent, "i", 1, shape);
+  case 2:
+    return array_new(self, sim -> serieshomog, "f", 1, shape);
+  default:
+    return array_new(self, sim -> seriesitems + sim -> currentstep * sim -> nitems, "i", 1, shape + 1);
+  }
+}
+
+/* sim_int: closure is the offset of an int field of Simulation */
+static PyObject * sim_int(SimObject * self, void * closure)
+{
+  if (!self -> sim)
+    return PyErr_Format(PyExc_RuntimeError, "Sim is not initialized");
+  return PyLong_FromLong(*(int *) ((char *) self -> sim + (size_t) closure));
+}
+
+static PyMethodDef sim_methods[] = {
+  {"step", (PyCFunction) sim_step, METH_VARARGS, "step(n=1): up to n steps without the GIL, the number taken"},
+  {"run", (PyCFunction) sim_run, METH_NOARGS, "run(): the remaining steps, the number taken"},
+  {"finish", (PyCFunction) sim_finish, METH_NOARGS, "finish(): write the final report and close the reports"},
+  {NULL}
+};
+
+static PyGetSetDef sim_getset[] = {
+  {"grid", (getter) sim_grid, NULL, "the grid, (size, size, 3) int32: item, status, birth phase", NULL},
+  {"items", (getter) sim_series, NULL, "agents per item now, (nitems,) int32", (void *) 3},
+  {"series_items", (getter) sim_series, NULL, "agents per item, (steps + 1, nitems) int32", (void *) 0},
+  {"series_mostfrequent", (getter) sim_series, NULL, "most frequent item, (steps + 1,) int32", (void *) 1},
+  {"series_homogeneity", (getter) sim_series, NULL, "homogeneity, (steps + 1,) float32", (void *) 2},
+  {"currentstep", (getter) sim_int, NULL, "steps taken", (void *) offsetof(Simulation, currentstep)},
+  {"nsteps", (getter) sim_int, NULL, "steps of the run", (void *) offsetof(Simulation, nsteps)},
+  {"ageclock", (getter) sim_int, NULL, "steps applied to the grid's ages", (void *) offsetof(Simulation, ageclock)},
+  {"size", (getter) sim_int, NULL, "grid side", (void *) offsetof(Simulation, size)},
+  {"maxage", (getter) sim_int, NULL, "maximum age", (void *) offsetof(Simulation, maxage)},
+  {"nitems", (getter) sim_int, NULL, "number of items", (void *) offsetof(Simulation, nitems)},
+  {NULL}
+};
+
+static PyTypeObject SimType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "socsim.Sim",
+  .tp_basicsize = sizeof(SimObject),
+  .tp_dealloc = (destructor) sim_dealloc,
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_doc = "Sim(path, size, steps, seed, maxage, agedistr, nitems, itemdistr, statdistr,\n"
+	    "    learningmode, bias, murate, normimpact, samples=0): a social impact run",
+  .tp_methods = sim_methods,
+  .tp_getset = sim_getset,
+  .tp_init = (initproc) sim_init,
+  .tp_new = PyType_GenericNew,
+};
+
+static struct PyModuleDef socsimmodule = {
+  PyModuleDef_HEAD_INIT,
+  "socsim",
+  "Social impact simulations in-process, with zero-copy views of their state.",
+  -1,
+  NULL,
+};
+
+PyMODINIT_FUNC PyInit_socsim(void)
+{
+  if (PyType_Ready(&SimType) < 0 || PyType_Ready(&ArrayType) < 0)
+    return NULL;
+  PyObject * m = PyModule_Create(&socsimmodule);
+  if (!m)
+    return NULL;
+  Py_INCREF(&SimType);
+  if (PyModule_AddObject(m, "Sim", (PyObject *) &SimType) < 0) {
+    Py_DECREF(&SimType);
+    Py_DECREF(m);
+    return NULL;
+  }
+  return m;
+}